@@ -45,9 +45,15 @@
 // ===================================================================================
 
 // Libraries
+#include <cfg.h>        // journaled configuration store
 #include <config.h>     // user configurations
 #include <delay.h>      // delay functions
+#include <event.h>      // input event queue
+#include <latency.h>    // input latency instrumentation
+#include <led.h>        // key LED functions
+#include <macro.h>      // macro player
 #include <neo.h>        // NeoPixel functions
+#include <scan.h>       // fixed-rate input scanner
 #include <system.h>     // system functions
 #include <usb_conkbd.h> // USB HID consumer keyboard functions
 #include <usb_descr.h>  // system functions
@@ -55,114 +61,259 @@
 // Prototypes for used interrupts
 void USB_interrupt(void);
 void USB_ISR(void) __interrupt(INT_NO_USB) { USB_interrupt(); }
-
-enum KeyType {
-  KEYBOARD = 0,
-  CONSUMER = 1,
-};
+void SCAN_ISR(void) __interrupt(INT_NO_TMR0) { SCAN_interrupt(); }
 
 enum RawHIDProtocolMessages {
   SET_RGB = 0x01,
   PERSIST_COLOR = 0x02,
   PERSIST_KEYS = 0x03,
+  SET_POLLING = 0x04,
+  GET_LATENCY = 0x05,
+  SET_EFFECT = 0x06,
+  STREAM_FRAME = 0x07,
+  GET_STREAM = 0x08,
+  SET_BRIGHTNESS = 0x0A,
+  READ_CONFIG = 0x0B,
+  WRITE_CONFIG = 0x0C,
+  COMMIT_CONFIG = 0x0D,
 };
 
-#define KEY_EEPROM_FIELDS 3
-#define KEY_COUNT 6
-#define LED_COUNT 3
-#define RGB_EEPROM_FIELDS 3
+#define KEY_COUNT CFG_KEYS
+#define LED_COUNT CFG_LEDS // key LEDs, the first pixels of the chain
+#define RGB_FIELDS 3
+#define CONFIG_CHUNK (EP2_SIZE - 3) // config bytes per raw packet
+#define EVENT_REPORTS 4 // reports of one event pass at most: a tap of a key with
+                        // modifier and array code sends 2 (NKRO) on each edge
 
-#define RGB_EEPROM_OFFSET KEY_COUNT *KEY_EEPROM_FIELDS
+uint8_t keysDown;                   // pressed keys (bit per key)
+uint8_t keysHold;                   // dual-function keys held as hold (bit per key)
+uint8_t layer;                      // active keymap layer
+uint8_t baseLayer;                  // layer to return to from a held layer
+__xdata uint8_t keyLayer[KEY_COUNT]; // layer a held key was pressed on
 
-// structur with key details
-struct key {
-  uint8_t mod;
-  enum KeyType type;
-  char code;
-  uint8_t last;
-};
+// show active layer by its key colors
+void show_layer(void) {
+  uint8_t i;
+  for (i = 0; i < LED_COUNT; i++)
+    LED_setColor(i, CFG.color[layer][i][0], CFG.color[layer][i][1],
+                 CFG.color[layer][i][2]);
+}
+
+// switch keymap layer
+void set_layer(uint8_t l) {
+  if (l >= CFG_LAYERS)
+    return;
+  layer = l;
+  show_layer();
+}
+
+// press or release the action of a key
+void key_action(uint8_t press, __xdata struct CFG_key *key) {
+  switch (key->type) {
+  case CFG_KEYBOARD:
+    if (press)
+      KBD_code_press(key->mod, key->code); // press keyboard/keypad key
+    else
+      KBD_code_release(key->mod, key->code); // release
+    break;
+  case CFG_CONSUMER:
+    if (press)
+      CON_press(key->code); // press consumer key
+    else
+      CON_release(key->code); // release
+    break;
+  case CFG_LAYER_HOLD: // layer while held
+    set_layer(press ? key->code : baseLayer);
+    break;
+  case CFG_LAYER_TO:
+    if (press && (key->code < CFG_LAYERS))
+      set_layer(baseLayer = key->code);
+    break;
+  case CFG_LAYER_NEXT:
+    if (press)
+      set_layer(baseLayer = (layer + 1 < CFG_LAYERS) ? layer + 1 : 0);
+    break;
+  case CFG_MACRO: // played from the main loop
+    if (press)
+      MAC_start(key->code);
+    break;
+  case CFG_MOD_TAP: // dual-function key tapped: plain key
+  case CFG_LAYER_TAP:
+    if (press)
+      KBD_code_press(0, key->code);
+    else
+      KBD_code_release(0, key->code);
+    break;
+  default:
+    break;
+  }
+}
+
+// press or release the hold action of a dual-function key
+void hold_action(uint8_t press, __xdata struct CFG_key *key) {
+  if (key->type == CFG_MOD_TAP) {
+    if (press)
+      KBD_code_press(key->mod, 0); // modifiers only
+    else
+      KBD_code_release(key->mod, 0);
+  } else {
+    set_layer(press ? key->mod : baseLayer);
+  }
+}
 
-struct RGBColor {
-  uint8_t r;
-  uint8_t g;
-  uint8_t b;
+#ifdef COMBO_DATA
+#if COMBO_ms > 40
+#error COMBO_ms too long for the latency timer (max 40)!
+#endif
+
+// combo: keys pressed together trigger their own action
+struct combo {
+  uint8_t keys;          // key bits
+  struct CFG_key action; // action of the combo
 };
+__code struct combo combos[] = {COMBO_DATA};
+#define COMBO_COUNT (sizeof(combos) / sizeof(combos[0]))
 
-// ===================================================================================
-// NeoPixel Functions
-// ===================================================================================
+uint8_t comboKeys;                      // keys that are part of any combo
+uint8_t comboDown;                      // keys of the pressed combo
+__bit comboHeld;                        // combo action pressed
+__xdata struct CFG_key comboAction;     // action of the pressed combo
+__xdata struct EVT_event *comboChecked; // key press already decided
 
-// Update NeoPixels
-void NEO_update(struct RGBColor *neo, float *percent, uint8_t state) {
+// decide whether a key press starts a combo by the presses queued within
+// COMBO_ms behind it, returns 0 while undecided. The cost is bounded by
+// EVT_SIZE * COMBO_COUNT, presses of keys in no combo return 1 at once.
+uint8_t resolve_combo(__xdata struct EVT_event *evt) {
+  __xdata struct EVT_event *next;
+  uint8_t n, c, keys, match, wider;
 
-  if (!state) {
-    EA = 0;                  // disable interrupts
-    NEO_writeColor(0, 0, 0); // NeoPixel 1 OFF
-    NEO_writeColor(0, 0, 0); // NeoPixel 2 OFF
-    NEO_writeColor(0, 0, 0); // NeoPixel 3 OFF
-    EA = 1;                  // enable interrupts
-  } else {
-    // percent glowing is not working :(
-    EA = 0;                                       // disable interrupts
-    NEO_writeColor(neo[0].r, neo[0].g, neo[0].b); // NeoPixel 1 lights up red
-    NEO_writeColor(neo[1].r, neo[1].g, neo[1].b); // NeoPixel 2 lights up green
-    NEO_writeColor(neo[2].r, neo[2].g, neo[2].b); // NeoPixel 3 lights up blue
-    EA = 1;                                       // enable interrupts
+  if ((evt->type != EVT_KEY_DOWN) || (evt == comboChecked) || comboDown ||
+      !(comboKeys & (1 << evt->data)))
+    return 1;
+
+  // collect keys pressed within the window, a release or knob turn ends it
+  keys = 1 << evt->data;
+  for (n = 1; (next = EVT_peekAt(n)); n++) {
+    if (((uint16_t)(next->time - evt->time) >= COMBO_ms) ||
+        (next->type != EVT_KEY_DOWN))
+      break;
+    keys |= 1 << next->data;
+  }
+
+  // look up combo, wait while a combo with more keys is still possible
+  match = 0xFF;
+  wider = 0;
+  for (c = 0; c < COMBO_COUNT; c++) {
+    if (combos[c].keys == keys)
+      match = c;
+    else if ((combos[c].keys & keys) == keys)
+      wider = 1;
   }
+  if (wider && !next && ((uint16_t)(SCAN_millis() - evt->time) < COMBO_ms))
+    return 0;
+  LAT_since(LAT_STAGE_COMBO, evt->tick, evt->time);
+  comboChecked = evt;
+  if (match == 0xFF)
+    return 1; // no combo: plain key press
+
+  // turn the presses into one combo event
+  evt->type = EVT_COMBO;
+  evt->data = match;
+  while (--n)
+    EVT_peekAt(n)->type = EVT_SKIP;
+  return 1;
 }
 
-// Read EEPROM (stolen from
-// https://github.com/DeqingSun/ch55xduino/blob/ch55xduino/ch55xduino/ch55x/cores/ch55xduino/eeprom.c)
-uint8_t eeprom_read_byte(uint8_t addr) {
-  ROM_ADDR_H = DATA_FLASH_ADDR >> 8;
-  ROM_ADDR_L = addr << 1; // Addr must be even
-  ROM_CTRL = ROM_CMD_READ;
-  return ROM_DATA_L;
+// press combo action, its keys are released together
+void press_combo(uint8_t c) {
+  comboChecked = 0; // event is consumed
+  comboAction.mod = combos[c].action.mod;
+  comboAction.type = combos[c].action.type;
+  comboAction.code = combos[c].action.code;
+  comboDown = combos[c].keys;
+  keysDown |= comboDown;
+  comboHeld = 1;
+  key_action(1, &comboAction);
 }
+#endif
 
-void eeprom_write_byte(__data uint8_t addr, __xdata uint8_t val) {
-  if (addr >= 128) {
-    return;
-  }
-  SAFE_MOD = 0x55;
-  SAFE_MOD = 0xAA;        // Enter Safe mode
-  GLOBAL_CFG |= bDATA_WE; // Enable DataFlash write
-  SAFE_MOD = 0;           // Exit Safe mode
-  ROM_ADDR_H = DATA_FLASH_ADDR >> 8;
-  ROM_ADDR_L = addr << 1;
-  ROM_DATA_L = val;
-  if (ROM_STATUS & bROM_ADDR_OK) { // Valid access Address
-    ROM_CTRL = ROM_CMD_WRITE;      // Write
+// decide tap or hold of a dual-function key press by the events queued behind
+// it, returns 0 while undecided. Other events return 1 at once, so keys without
+// hold action are never delayed.
+uint8_t resolve_key(__xdata struct EVT_event *evt) {
+  __xdata struct EVT_event *next;
+  uint8_t n, i, type, other = 0;
+
+  i = evt->data;
+  if ((evt->type != EVT_KEY_DOWN) || (keysDown & (1 << i)))
+    return 1;
+  type = CFG.key[layer][i].type;
+  if ((type != CFG_MOD_TAP) && (type != CFG_LAYER_TAP))
+    return 1; // no hold action
+
+  for (n = 1; (next = EVT_peekAt(n)); n++) {
+    if ((uint16_t)(next->time - evt->time) >= TAP_TERM_ms)
+      break; // held for the tapping term
+    if ((next->type == EVT_KEY_UP) && (next->data == i))
+      return 1; // released in time: tap
+#ifdef TAP_PERMISSIVE_HOLD
+    if (next->type == EVT_KEY_DOWN)
+      other |= 1 << next->data;
+    else if ((next->type == EVT_ENCODER) ||
+             ((next->type == EVT_KEY_UP) && (other & (1 << next->data))))
+      break; // other key tapped meanwhile
+#endif
   }
-  SAFE_MOD = 0x55;
-  SAFE_MOD = 0xAA;         // Enter Safe mode
-  GLOBAL_CFG &= ~bDATA_WE; // Disable DataFlash write
-  SAFE_MOD = 0;            // Exit Safe mode
+  if (!next && ((uint16_t)(SCAN_millis() - evt->time) < TAP_TERM_ms))
+    return 0; // wait for more events or the tapping term
+  keysHold |= 1 << i;
+  return 1;
 }
 
-// handle key press
-void handle_key(uint8_t current, struct key *key, float *neo) {
-  if (current != key->last) { // state changed?
-    key->last = current;      // update last state flag
-    if (current) {            // key was pressed?
-      if (key->type == KEYBOARD) {
-        KBD_code_press(key->mod, key->code); // press keyboard/keypad key
-      } else {
-        CON_press(key->code); // press consumer key
-      }
-      if (neo)
-        *neo = NEO_MAX;
-    } else { // key was released?
-      if (key->type == KEYBOARD) {
-        KBD_code_release(key->mod,
-                         key->code); // release
-      } else {
-        CON_release(key->code); // release
-      }
-    }
-  } else if (key->last) { // key still being pressed?
-                          // if(neo) *neo = NEO_MAX;                 // keep
-                          // NeoPixel on
+#ifdef MOUSE_WHEEL
+// quadrature steps per knob event: single steps while both knob directions
+// scroll an axis the host has switched to high resolution
+uint8_t knob_div(void) {
+  uint8_t type = CFG.key[layer][4].type;
+  if (type != CFG.key[layer][5].type)
+    return ENC_STEPS_PER_DETENT;
+  if (((type == CFG_WHEEL) && (HID_feature & HID_FEATURE_WHEEL)) ||
+      ((type == CFG_PAN) && (HID_feature & HID_FEATURE_PAN)))
+    return 1;
+  return ENC_STEPS_PER_DETENT;
+}
+#endif
+
+// handle key press, the release uses the layer and the tap/hold decision of
+// the press
+void handle_key(uint8_t current, uint8_t i) {
+  __xdata struct CFG_key *key;
+  uint8_t bit = 1 << i;
+
+#ifdef COMBO_DATA
+  comboChecked = 0;                    // event is consumed
+  if (!current && (comboDown & bit)) { // key of the pressed combo released?
+    keysDown &= ~bit;
+    comboDown &= ~bit;
+    if (comboHeld) // first key released: release combo action
+      key_action(0, &comboAction);
+    comboHeld = 0;
+    return;
+  }
+#endif
+  if (current != !!(keysDown & bit)) { // state changed?
+    keysDown ^= bit;                   // update last state flag
+    if (current)                       // key was pressed?
+      keyLayer[i] = layer;
+    key = &CFG.key[keyLayer[i]][i];
+    if (keysHold & bit)
+      hold_action(current, key);
+    else
+      key_action(current, key);
+    if (current)
+      LED_flash(i); // ignored for keys without LED
+    else
+      keysHold &= ~bit;
   }
 }
 
@@ -171,83 +322,121 @@ void handle_key(uint8_t current, struct key *key, float *neo) {
 // ===================================================================================
 void main(void) {
   // Variables
-  struct key keys[KEY_COUNT]; // array of struct for keys
-  struct key *currentKnobKey; // current key to be sent by knob
+  uint8_t knob;               // knob entry of the keymap for a detent
+  __xdata struct CFG_key *key; // keymap entry of the knob
   __idata uint8_t i;          // temp variable
-  struct RGBColor buttonColors[LED_COUNT];
-  float percent[LED_COUNT] = {0.0, 0.0, 0.0};
-  int state = 0;
+  __xdata struct EVT_event *evt; // input event from scanner
+  __xdata struct EVT_event *timed = 0; // event whose latency is recorded
+  int8_t detents;             // knob steps of an encoder event
+  uint16_t lastRefresh = 0;   // time of last NeoPixel refresh
+  __xdata uint8_t reply[EP2_SIZE]; // raw HID reply
+  __xdata uint8_t *p;         // stream write pointer
+  uint8_t r, g, b;             // temp color channels / effect parameters
+  uint8_t state = 0;          // LEDs on (Caps Lock off)
 
   // Enter bootloader if key 1 is pressed
   NEO_init();                // init NeoPixels
   if (!PIN_read(PIN_KEY1)) { // key 1 pressed?
     NEO_latch();             // make sure pixels are ready
-    for (i = 9; i; i--)
-      NEO_sendByte(255 * NEO_MAX); // light up all pixels
+    for (i = NEO_COUNT * 3; i; i--)
+      NEO_sendByte(NEO_MAX);       // light up all pixels
     BOOT_now();                    // enter bootloader
   }
 
   // Setup
   CLK_config(); // configure system clock
   DLY_ms(5);    // wait for clock to settle
+  CFG_load();   // load configuration from DataFlash
+  USB_setProfile(CFG.polling); // polling profile
+  LAT_init();   // start latency timestamp timer
   KBD_init();   // init USB HID keyboard
+  SCAN_init();  // start input scanner
   WDT_start();  // start watchdog timer
 
-  // TODO: Read eeprom for key characters
-  for (i = 0; i < 6; i++) {
-    keys[i].mod = (char)eeprom_read_byte(i * KEY_EEPROM_FIELDS);
-    keys[i].type = eeprom_read_byte(i * KEY_EEPROM_FIELDS + 1);
-    keys[i].code = (char)eeprom_read_byte(i * KEY_EEPROM_FIELDS + 2);
-    keys[i].last = 0;
-  }
-
-  for (i = 0; i < 3; i++) {
-    buttonColors[i].r =
-        (char)eeprom_read_byte(i * RGB_EEPROM_FIELDS + (RGB_EEPROM_OFFSET));
-    buttonColors[i].g =
-        (char)eeprom_read_byte(i * RGB_EEPROM_FIELDS + 1 + (RGB_EEPROM_OFFSET));
-    buttonColors[i].b =
-        (char)eeprom_read_byte(i * RGB_EEPROM_FIELDS + 2 + (RGB_EEPROM_OFFSET));
-  }
+  LED_init();
+  show_layer(); // colors of layer 0
+#ifdef COMBO_DATA
+  for (i = 0; i < COMBO_COUNT; i++)
+    comboKeys |= combos[i].keys;
+#endif
 
   // Loop
   while (1) {
-    handle_key(!PIN_read(PIN_KEY1), &keys[0], &percent[0]);
-    handle_key(!PIN_read(PIN_KEY2), &keys[1], &percent[1]);
-    handle_key(!PIN_read(PIN_KEY3), &keys[2], &percent[2]);
-    handle_key(!PIN_read(PIN_ENC_SW), &keys[3], (void *)0);
-
-    // Handle knob
-    currentKnobKey = 0;         // clear key variable
-    if (!PIN_read(PIN_ENC_A)) { // encoder turned ?
-      if (PIN_read(PIN_ENC_B)) {
-        currentKnobKey = &keys[4]; // clockwise?
-      } else {
-        currentKnobKey = &keys[5]; // counter-clockwise?
-      }
-      DLY_ms(10); // debounce
-      while (!PIN_read(PIN_ENC_A))
-        ; // wait until next detent
-    }
+#ifdef MOUSE_WHEEL
+    SCAN_encDiv = knob_div(); // knob resolution for the active layer
+#endif
 
-    if (currentKnobKey) {
-      if (currentKnobKey->type == KEYBOARD) {
-        KBD_code_type(
-            currentKnobKey->mod,
-            currentKnobKey->code); // press and release corresponding key ...
-      } else {
-        CON_type(
-            currentKnobKey->code); // press and release corresponding key ...
+    // Report stage: turn queued input events into HID reports, one step at a
+    // time and only while the report queue has room, so it never waits on USB
+    while ((HID_queueFree() >= EVENT_REPORTS) && (evt = EVT_peek())) {
+#ifdef COMBO_DATA
+      if (!resolve_combo(evt))
+        break;              // combo still possible
+#endif
+      if (!resolve_key(evt))
+        break;              // dual-function key still undecided
+      if (evt->type == EVT_SKIP) {
+        EVT_pop();          // merged into a combo, nothing to time
+        continue;
+      }
+      if (evt != timed) {   // first pass of this event (knob: one per detent)
+        LAT_start(evt->tick, evt->time); // time the reports of this event
+        timed = evt;
+      }
+      switch (evt->type) {
+      case EVT_KEY_DOWN:
+      case EVT_KEY_UP:
+        handle_key(evt->type == EVT_KEY_DOWN, evt->data);
+        EVT_pop(); // release event slot to scanner
+        break;
+#ifdef COMBO_DATA
+      case EVT_COMBO:
+        press_combo(evt->data);
+        EVT_pop();
+        break;
+#endif
+      case EVT_ENCODER:
+        detents = (int8_t)evt->data;
+        knob = (detents > 0) ? 4 : 5; // clockwise or counter-clockwise
+        key = &CFG.key[layer][knob];
+#ifdef MOUSE_WHEEL
+        if ((key->type == CFG_WHEEL) || (key->type == CFG_PAN)) {
+          if (detents < 0)
+            detents = -detents;
+          if (key->type == CFG_WHEEL) // all steps at once, sent by MOU_send
+            MOU_scroll(detents * (int8_t)key->code, 0);
+          else
+            MOU_scroll(0, detents * (int8_t)key->code);
+          EVT_pop();
+          break;
+        }
+#endif
+        detents += (detents > 0) ? -1 : 1;
+        key_action(1, key); // press and release
+        key_action(0, key);
+        evt->data = detents;       // remaining detents
+        if (!detents)
+          EVT_pop();
+        break;
+      default:
+        EVT_pop();
+        break;
       }
+      LAT_stop();
+      if (EVT_peek() != evt)
+        timed = 0; // event popped
     }
+    MAC_run(); // play macros with the report queue room left
+#ifdef MOUSE_WHEEL
+    MOU_send(); // wheel movement, merged while the queue is busy
+#endif
 
     // Update NeoPixels
-    NEO_update(buttonColors, percent, state);
-    for (i = 0; i < 3; i++) {
-      if (percent[i] > NEO_GLOW)
-        percent[i] = -0.01; // fade down NeoPixel
+    if (SCAN_millis() - lastRefresh >= NEO_REFRESH_ms) {
+      lastRefresh += NEO_REFRESH_ms; // fixed effect tick
+      LED_tick(); // advance LED effects
+      LED_update(state); // show them in the same period
     }
-    DLY_ms(5); // latch and debounce
 
     // Handle HID Raw data
     if (HID_available()) { // received data packet?
@@ -256,24 +445,125 @@ void main(void) {
       int message = HID_read();
       switch (message) {
       case SET_RGB:
-        for (int j = 0; j < i / LED_COUNT; j++) {
-          buttonColors[j].r = HID_read();
-          buttonColors[j].g = HID_read();
-          buttonColors[j].b = HID_read();
+        for (int j = 0; (j < i / RGB_FIELDS) && (j < NEO_COUNT); j++) {
+          r = HID_read();
+          g = HID_read();
+          LED_setColor(j, r, g, HID_read());
         }
         break;
-      case PERSIST_COLOR:
-        if (i != 4 * KEY_COUNT) {
-          break;
-        } else {
-          while (i--) {
-            int read = HID_read();
-            if (eeprom_read_byte(RGB_EEPROM_OFFSET + i) != read) {
-              // eeprom_write_byte(RGB_EEPROM_OFFSET + i, read);
-            }
+      case PERSIST_COLOR: // [r, g, b] * LED_COUNT -> [cmd, ok], active layer
+        if (i >= sizeof(CFG.color[0])) {
+          for (p = CFG.color[layer][0], i = sizeof(CFG.color[0]); i; i--)
+            *p++ = HID_read();
+          show_layer();
+          reply[0] = PERSIST_COLOR;
+          reply[1] = CFG_commit();
+          HID_reply(reply, 2);
+        }
+        break;
+      case PERSIST_KEYS: // [mod, type, code] * KEY_COUNT -> [cmd, ok], active layer
+        if (i >= sizeof(CFG.key[0])) {
+          for (p = (__xdata uint8_t *)CFG.key[layer], i = sizeof(CFG.key[0]);
+               i; i--)
+            *p++ = HID_read();
+          reply[0] = PERSIST_KEYS;
+          reply[1] = CFG_commit();
+          HID_reply(reply, 2);
+        }
+        break;
+      case SET_POLLING: // [profile] -> [cmd, ok], used on next enumeration
+        if (i) {
+          CFG.polling = HID_read();
+          reply[0] = SET_POLLING;
+          reply[1] = CFG_commit();
+          HID_reply(reply, 2);
+        }
+        break;
+      case SET_EFFECT: // [led (0xFF: all), effect, speed, level]
+        if (i >= 4) {
+          i = HID_read();
+          r = HID_read();
+          g = HID_read();
+          b = HID_read();
+          for (int j = 0; j < NEO_COUNT; j++) {
+            if ((i == 0xFF) || (i == j))
+              LED_setEffect(j, r, g, b);
           }
         }
-
+        break;
+      case STREAM_FRAME: // [seq, r, g, b, ...] whole frame in one packet
+        if (i >= 1 + NEO_COUNT * 3) {
+          r = HID_read(); // sequence number
+          for (p = LED_back[0], i = NEO_COUNT * 3; i; i--)
+            *p++ = HID_read();
+          LED_stream(r); // swapped in on next tick
+        }
+        break;
+      case SET_BRIGHTNESS: // [brightness]
+        if (i)
+          LED_setBrightness(HID_read());
+        break;
+      case READ_CONFIG: // [offset] -> [cmd, offset, size, data...]
+        reply[1] = i ? HID_read() : 0;
+        reply[2] = CFG_SIZE;
+        for (i = 0; (i < CONFIG_CHUNK) && (reply[1] + i < CFG_SIZE); i++)
+          reply[3 + i] = CFG_image[reply[1] + i];
+        reply[0] = READ_CONFIG;
+        HID_reply(reply, 3 + i);
+        break;
+      case WRITE_CONFIG: // [offset, count, data...] staged until committed
+        if (i >= 2) {
+          r = HID_read(); // offset
+          g = HID_read(); // count
+          if ((i >= 2 + g) && (g <= CONFIG_CHUNK) && (r < CFG_SIZE) &&
+              (g <= CFG_SIZE - r)) {
+            if (!r) // new transfer: start from the current config
+              for (i = 0; i < CFG_SIZE; i++)
+                CFG_staged[i] = CFG_image[i];
+            for (p = &CFG_staged[r]; g; g--)
+              *p++ = HID_read();
+          }
+        }
+        break;
+      case COMMIT_CONFIG: // [crc] -> [cmd, ok, crc], staged config if valid
+        reply[0] = COMMIT_CONFIG;
+        reply[1] = 0;
+        reply[2] = CFG_checksum(CFG_staged);
+        if (i && (reply[2] == (uint8_t)HID_read()) &&
+            (CFG_staged[0] == CFG_VERSION)) {
+          for (i = 0; i < CFG_SIZE; i++)
+            CFG_image[i] = CFG_staged[i];
+          reply[1] = CFG_commit();
+          if (!reply[1])
+            CFG_load(); // keep the stored config
+          show_layer();
+        }
+        HID_reply(reply, 3);
+        break;
+      case GET_STREAM: // -> [cmd, received, shown, late, dropped], clears them
+        reply[0] = GET_STREAM;
+        for (i = 0; i < sizeof(struct LED_streamStat); i++)
+          reply[1 + i] = ((__xdata uint8_t *)&LED_streamStat)[i];
+        LED_streamReset();
+        HID_reply(reply, 1 + sizeof(struct LED_streamStat));
+        break;
+      case GET_LATENCY: // [stage, clear] -> [cmd, stage, ticks/ms, counters,
+                        //   event ring high-water mark, dropped macro starts]
+        if (i) {
+          reply[0] = GET_LATENCY;
+          reply[1] = HID_read();
+          reply[2] = (uint8_t)LAT_TICKS_PER_ms;
+          reply[3] = (uint8_t)(LAT_TICKS_PER_ms >> 8);
+          r = (i > 1) && HID_read(); // clear
+          LAT_get(reply[1], (__xdata struct LAT_stat *)&reply[4], r);
+          reply[4 + sizeof(struct LAT_stat)] = EVT_maxDepth;
+          reply[5 + sizeof(struct LAT_stat)] = MAC_dropped;
+          if (r && (reply[1] == LAT_STAGE_EVENT)) {
+            EVT_maxDepth = 0;
+            MAC_dropped = 0;
+          }
+          HID_reply(reply, 6 + sizeof(struct LAT_stat));
+        }
         break;
       default:
         break;
@@ -288,7 +578,6 @@ void main(void) {
       state = 0;
     }
 
-
     WDT_reset(); // reset watchdog
   }
 }
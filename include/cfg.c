@@ -0,0 +1,131 @@
+// ===================================================================================
+// Journaled Configuration Store in DataFlash for CH551, CH552 and CH554
+// ===================================================================================
+
+#include "cfg.h"
+#include "ch554.h"
+
+// ===================================================================================
+// Variables
+// ===================================================================================
+__xdata struct CFG_config CFG;                  // current configuration
+__xdata uint8_t CFG_staged[CFG_SIZE];           // upload from the host
+uint16_t CFG_seq;                               // sequence number of newest record
+uint8_t CFG_slot;                               // slot for the next record
+
+// DataFlash in code space, only every even address is used
+#define CFG_flash(addr)   (((__code uint8_t *)DATA_FLASH_ADDR)[(uint8_t)(addr) << 1])
+
+// ===================================================================================
+// DataFlash Write (byte address)
+// ===================================================================================
+void CFG_writeByte(uint8_t addr, uint8_t val) {
+  if(CFG_flash(addr) == val) return;            // spare a write cycle
+  ROM_ADDR_H = DATA_FLASH_ADDR >> 8;
+  ROM_ADDR_L = addr << 1;
+  ROM_DATA_L = val;
+  if(ROM_STATUS & bROM_ADDR_OK) ROM_CTRL = ROM_CMD_WRITE;
+}
+
+void CFG_writeEnable(uint8_t enable) {
+  SAFE_MOD = 0x55;
+  SAFE_MOD = 0xAA;                              // enter safe mode
+  if(enable) GLOBAL_CFG |= bDATA_WE;            // enable DataFlash write
+  else       GLOBAL_CFG &= ~bDATA_WE;           // disable DataFlash write
+  SAFE_MOD = 0;                                 // exit safe mode
+}
+
+// ===================================================================================
+// CRC-8 (polynomial 0x31) over Sequence Number and Config of a Record in Place
+// ===================================================================================
+uint8_t CFG_crcByte(uint8_t crc, uint8_t data) {
+  uint8_t i;
+  crc ^= data;
+  for(i = 8; i; i--) crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+  return crc;
+}
+
+uint8_t CFG_crc(uint8_t addr) {
+  uint8_t i, crc = 0xFF;
+  for(i = 1; i < CFG_SIZE + 3; i++) crc = CFG_crcByte(crc, CFG_flash(addr + i));
+  return crc;
+}
+
+// ===================================================================================
+// CRC-8 over a Config Image (same polynomial, for host transfers)
+// ===================================================================================
+uint8_t CFG_checksum(__xdata uint8_t *cfg) {
+  uint8_t i, crc = 0xFF;
+  for(i = 0; i < CFG_SIZE; i++) crc = CFG_crcByte(crc, cfg[i]);
+  return crc;
+}
+
+uint8_t CFG_valid(uint8_t addr) {
+  return (CFG_flash(addr) == CFG_MAGIC) && (CFG_flash(addr + CFG_SIZE + 3) == CFG_crc(addr));
+}
+
+// ===================================================================================
+// Load newest valid Record (or old Layout) into CFG
+// ===================================================================================
+void CFG_load(void) {
+  uint8_t i, addr, newest = 0xFF, journal = 0;
+  uint16_t seq;
+
+  for(addr = 0; addr + CFG_RECORD_SIZE <= CFG_FLASH_SIZE; addr += CFG_RECORD_SIZE) {
+    if(CFG_flash(addr) == CFG_MAGIC) journal = 1;
+    if(!CFG_valid(addr) || (CFG_flash(addr + 3) != CFG_VERSION)) continue;
+    seq = CFG_flash(addr + 1) | ((uint16_t)CFG_flash(addr + 2) << 8);
+    if((newest == 0xFF) || ((int16_t)(seq - CFG_seq) > 0)) {
+      newest  = addr;
+      CFG_seq = seq;
+    }
+  }
+
+  if(newest != 0xFF) {
+    for(i = 0; i < CFG_SIZE; i++) CFG_image[i] = CFG_flash(newest + 3 + i);
+    CFG_slot = newest / CFG_RECORD_SIZE + 1;
+    if(CFG_slot >= CFG_SLOTS) CFG_slot = 0;
+    return;
+  }
+
+  if(journal) {                                 // unusable records: empty config
+    for(i = 0; i < CFG_SIZE; i++) CFG_image[i] = 0;
+  }
+  else {                                        // no record: old layout
+    for(i = 0; i < CFG_LAYERS * sizeof(CFG.key[0]); i++)
+      ((__xdata uint8_t *)CFG.key)[i] = CFG_flash(i % sizeof(CFG.key[0]));
+    for(i = 0; i < CFG_LAYERS * sizeof(CFG.color[0]); i++)
+      ((__xdata uint8_t *)CFG.color)[i] = CFG_flash(sizeof(CFG.key[0]) + i % sizeof(CFG.color[0]));
+    CFG.polling = CFG_flash(sizeof(CFG.key[0]) + sizeof(CFG.color[0]));
+  }
+  CFG.version = CFG_VERSION;
+  CFG_seq  = 0;
+  CFG_slot = 1;                                 // keep old layout until committed
+}
+
+// ===================================================================================
+// Append CFG as new Record, returns 1 if it reads back valid
+// ===================================================================================
+uint8_t CFG_commit(void) {
+  uint8_t i, ok, addr = CFG_slot * CFG_RECORD_SIZE;
+  uint16_t seq = CFG_seq + 1;
+
+  CFG.version = CFG_VERSION;
+  CFG_writeEnable(1);
+  CFG_writeByte(addr, 0);                       // invalidate old record first
+  CFG_writeByte(addr + 1, seq);
+  CFG_writeByte(addr + 2, seq >> 8);
+  for(i = 0; i < CFG_SIZE; i++) CFG_writeByte(addr + 3 + i, CFG_image[i]);
+  for(ok = 1, i = 0; i < CFG_SIZE; i++)         // verify before sealing
+    if(CFG_flash(addr + 3 + i) != CFG_image[i]) ok = 0;
+  if(ok) {
+    CFG_writeByte(addr + CFG_SIZE + 3, CFG_crc(addr));
+    CFG_writeByte(addr, CFG_MAGIC);             // record is complete
+  }
+  CFG_writeEnable(0);
+
+  if(!ok || !CFG_valid(addr)) return 0; // slot is rewritten next time
+  CFG_slot = (CFG_slot + 1 < CFG_SLOTS) ? CFG_slot + 1 : 0;
+  CFG_seq  = seq;
+  return 1;
+}
@@ -0,0 +1,80 @@
+// ===================================================================================
+// Journaled Configuration Store in DataFlash for CH551, CH552 and CH554
+// ===================================================================================
+//
+// The configuration is one packed, versioned struct in XRAM (CFG), which the
+// firmware uses directly, and it is persisted as a whole. It holds CFG_LAYERS
+// layers of key assignments and key LED colors; an action is found by a flat
+// lookup CFG.key[layer][key], independent of the number of layers. The 128 bytes of
+// DataFlash are divided into CFG_SLOTS record slots, which are written
+// round-robin, so every slot wears at the same rate:
+//
+//   record = magic, sequence number (16 bit), config, CRC-8 over seq and config
+//
+// CFG_load() checks all slots in place (DataFlash is read with MOVC from code
+// space) and copies only the newest valid record with the current version in
+// one pass. A commit first invalidates the magic of the slot it reuses, then
+// writes sequence number and config, verifies them and only then writes CRC
+// and magic. A record interrupted by power loss therefore never validates,
+// and the previous record stays in effect. Only a verified record moves on to
+// the next slot; after a failed commit the same slot is written again, so the
+// slot holding the last valid record is never touched by the retry.
+//
+// Only if DataFlash holds no record at all, the config is read from the old
+// byte-per-setting layout at its start into all layers, so existing units keep
+// their settings; records that do not validate give an empty config. The first
+// commit then goes to slot 1, which does not overlap the old layout.
+//
+// The following must be defined in config.h:
+// CFG_LAYERS - number of keymap layers
+
+#pragma once
+#include <stdint.h>
+#include "config.h"
+
+#define CFG_VERSION       2                           // layout of struct CFG_config
+#define CFG_KEYS          6                           // keys 1..3, knob switch, cw, ccw
+#define CFG_LEDS          3                           // key LEDs with stored color
+
+// Key types
+#define CFG_KEYBOARD      0                           // code: keyboard usage
+#define CFG_CONSUMER      1                           // code: consumer usage
+#define CFG_LAYER_HOLD    2                           // code: layer active while held
+#define CFG_LAYER_TO      3                           // code: layer to switch to
+#define CFG_LAYER_NEXT    4                           // switch to next layer
+#define CFG_MACRO         5                           // code: macro number (macro.h)
+#define CFG_MOD_TAP       6                           // tap: code, hold: modifiers mod
+#define CFG_LAYER_TAP     7                           // tap: code, hold: layer mod
+#define CFG_WHEEL         8                           // knob: code signed wheel units
+#define CFG_PAN           9                           // knob: code signed AC Pan units
+
+struct CFG_key {
+  uint8_t mod;                                        // modifier bits
+  uint8_t type;                                       // key type
+  uint8_t code;                                       // usage code
+};
+
+struct CFG_config {
+  uint8_t version;                                    // CFG_VERSION
+  struct CFG_key key[CFG_LAYERS][CFG_KEYS];           // key assignment per layer
+  uint8_t color[CFG_LAYERS][CFG_LEDS][3];             // key LED colors per layer
+  uint8_t polling;                                    // USB polling profile
+};
+
+#define CFG_SIZE          (2 + CFG_LAYERS * (CFG_KEYS + CFG_LEDS) * 3) // sizeof(CFG)
+#define CFG_MAGIC         0xA5                        // marks a complete record
+#define CFG_FLASH_SIZE    128                         // bytes of DataFlash
+#define CFG_RECORD_SIZE   (CFG_SIZE + 4)              // magic, seq, config, CRC
+#define CFG_SLOTS         (CFG_FLASH_SIZE / CFG_RECORD_SIZE)
+
+#if CFG_SLOTS < 2
+  #error Configuration too big for a journal in DataFlash, reduce CFG_LAYERS!
+#endif
+
+extern __xdata struct CFG_config CFG;                 // current configuration
+#define CFG_image ((__xdata uint8_t *)&CFG)           // configuration as bytes
+extern __xdata uint8_t CFG_staged[CFG_SIZE];          // upload from the host
+
+void CFG_load(void);                                  // read newest record into CFG
+uint8_t CFG_commit(void);                             // persist CFG, 1 if verified
+uint8_t CFG_checksum(__xdata uint8_t *cfg);           // CRC-8 (0x31, init 0xFF) of image
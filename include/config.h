@@ -13,20 +13,59 @@
 #define PIN_ENC_A           P31         // pin connected to knob outA
 #define PIN_ENC_B           P30         // pin connected to knob outB
 
+// Input scanner configuration
+#define SCAN_RATE_HZ        1000        // key/knob sample rate in Hz (1000..8000)
+#define SCAN_DEBOUNCE_ms    5           // ignore bounce for this time after a change
+#define ENC_STEPS_PER_DETENT 4          // quadrature steps per knob detent (1, 2, 4)
+
+// Keymap configuration
+#define CFG_LAYERS          2           // keymap layers (1 or 2, stored in DataFlash)
+#define TAP_TERM_ms         200         // dual-function key: held longer is a hold
+#define TAP_PERMISSIVE_HOLD             // hold if another key is tapped meanwhile
+
+// Combos: keys pressed within COMBO_ms trigger their own action { mod, type, code }
+// (key bits: key 1..3 = 0x01, 0x02, 0x04, knob switch = 0x08). Presses of keys
+// in a combo wait up to COMBO_ms, so they are off by default, for example:
+#define COMBO_ms            30          // window for the keys of a combo (max 40)
+//#define COMBO_DATA                    /* lines joined with backslashes */
+//  { 0x03, { 0, CFG_CONSUMER, 0xE2 } },          /* 1+2: mute       */
+//  { 0x06, { 0, CFG_LAYER_NEXT, 0 } }            /* 2+3: next layer */
+
+// Macros (steps see macro.h), started by keys of type 5 with code = macro number
+#define MAC_DATA \
+  MAC_TAP, 0x01, 0x06, MAC_END,                   /* 0: copy (Ctrl+C)   */ \
+  MAC_TAP, 0x01, 0x19, MAC_END,                   /* 1: paste (Ctrl+V)  */ \
+  'H','e','l','l','o',' ','W','o','r','l','d','\n', MAC_END  /* 2: text */
+
 // NeoPixel configuration
 #define NEO_GRB                         // type of pixel: NEO_GRB or NEO_RGB
-#define NEO_MIN             0
-#define NEO_GLOW            0.4
-#define NEO_MAX             1.0
+//#define NEO_SPI                       // drive pixels by SPI0 on MOSI (P1.5)
+#define NEO_COUNT           3           // pixels in the chain, first 3 are the keys
+#define NEO_GLOW            102         // brightness at rest (0..255)
+#define NEO_MAX             255         // brightness on key press (0..255)
+#define NEO_FADE            3           // brightness decrease per refresh
+#define NEO_REFRESH_ms      5           // LED effect tick and refresh period
+#define NEO_BRIGHTNESS      255         // default global brightness (0..255)
+#define NEO_CURRENT_mA      30          // current budget of all pixels
+#define NEO_CHANNEL_mA      20          // current of one pixel channel at 255
 
 // USB device descriptor
 #define USB_VENDOR_ID       0x4249      // VID
 #define USB_PRODUCT_ID      0x4287      // PID
 #define USB_DEVICE_VERSION  0x0100      // v1.0 (BCD-format)
 
+// Keyboard reports
+#define KBD_NKRO                        // N-key rollover bitmap report (not in boot mode)
+#define MOUSE_WHEEL                     // wheel/AC Pan mouse report for the knob
+
 // USB configuration descriptor
 #define USB_MAX_POWER_mA    50          // max power in mA
 
+// USB endpoint polling intervals in ms (profile is persisted, see SET_POLLING)
+#define USB_POLL_ms         10          // standard profile, all endpoints
+#define USB_POLL_FAST_ms    1           // low-latency profile, keyboard endpoint
+#define USB_POLL_RAW_ms     2           // low-latency profile, raw HID endpoint
+
 // USB descriptor strings
 #define MANUFACTURER_STR    'w','a','g','i','m','i','n','a','t','o','r'
 #define PRODUCT_STR         'M','a','c','r','o','P','a','d'
@@ -0,0 +1,51 @@
+// ===================================================================================
+// Input Event Queue for CH551, CH552 and CH554
+// ===================================================================================
+
+#include "event.h"
+
+#if EVT_SIZE & (EVT_SIZE - 1)
+  #error EVT_SIZE must be a power of two!
+#endif
+
+// ===================================================================================
+// Variables
+// ===================================================================================
+__xdata struct EVT_event EVT_ring[EVT_SIZE];    // event ring buffer
+volatile uint8_t EVT_head;                      // free running, written by producer
+volatile uint8_t EVT_tail;                      // free running, written by consumer
+__xdata uint8_t EVT_maxDepth;                   // high-water mark of the ring
+
+// ===================================================================================
+// Producer Functions (called from interrupt)
+// ===================================================================================
+#pragma save
+#pragma nooverlay
+__xdata struct EVT_event *EVT_reserve(void) {
+  if((uint8_t)(EVT_head - EVT_tail) >= EVT_SIZE) return 0;  // ring is full
+  return &EVT_ring[EVT_head & (EVT_SIZE - 1)];
+}
+
+void EVT_commit(void) {
+  EVT_head++;                                   // publish event
+  if((uint8_t)(EVT_head - EVT_tail) > EVT_maxDepth)
+    EVT_maxDepth = EVT_head - EVT_tail;
+}
+#pragma restore
+
+// ===================================================================================
+// Consumer Functions (called from main loop)
+// ===================================================================================
+__xdata struct EVT_event *EVT_peek(void) {
+  if(EVT_head == EVT_tail) return 0;            // ring is empty
+  return &EVT_ring[EVT_tail & (EVT_SIZE - 1)];
+}
+
+__xdata struct EVT_event *EVT_peekAt(uint8_t n) {
+  if((uint8_t)(EVT_head - EVT_tail) <= n) return 0;   // fewer events queued
+  return &EVT_ring[(EVT_tail + n) & (EVT_SIZE - 1)];
+}
+
+void EVT_pop(void) {
+  EVT_tail++;                                   // release slot to producer
+}
@@ -0,0 +1,44 @@
+// ===================================================================================
+// Input Event Queue for CH551, CH552 and CH554
+// ===================================================================================
+//
+// Lock-free single-producer/single-consumer ring buffer in XRAM. The scanner
+// interrupt produces timestamped input events, the report stage in the main
+// loop consumes them. Each index is written by one side only and is a single
+// byte, so no interrupt locking is needed.
+//
+// Producer (interrupt):  evt = EVT_reserve(); fill *evt; EVT_commit();
+// Consumer (main loop):  while(evt = EVT_peek()) { handle *evt; EVT_pop(); }
+//
+// EVT_reserve() returns 0 if the ring is full. The producer must then keep the
+// input pending and try again on its next run, so that no edge is lost.
+// EVT_peekAt() lets the consumer look ahead at later events without popping.
+// The consumer may rewrite events it has not popped yet (e.g. several key
+// presses into one combo event and skipped events).
+
+#pragma once
+#include <stdint.h>
+
+#define EVT_SIZE          16                          // ring size (power of two)
+
+// Event types
+#define EVT_KEY_DOWN      0x01                        // data: key index
+#define EVT_KEY_UP        0x02                        // data: key index
+#define EVT_ENCODER       0x03                        // data: signed knob steps (see SCAN_encDiv)
+#define EVT_SKIP          0x00                        // consumed by the consumer
+#define EVT_COMBO         0x04                        // data: combo number (consumer)
+
+struct EVT_event {
+  uint8_t  type;                                      // event type
+  uint8_t  data;                                      // event data
+  uint16_t time;                                      // timestamp in ms
+  uint16_t tick;                                      // Timer2 time of the pin edge
+};
+
+extern __xdata uint8_t EVT_maxDepth;                  // high-water mark of the ring
+
+__xdata struct EVT_event *EVT_reserve(void);          // producer: get free slot or 0
+void EVT_commit(void);                                // producer: publish reserved slot
+__xdata struct EVT_event *EVT_peek(void);             // consumer: get oldest event or 0
+__xdata struct EVT_event *EVT_peekAt(uint8_t n);      // consumer: get n-th event or 0
+void EVT_pop(void);                                   // consumer: release oldest event
@@ -0,0 +1,127 @@
+// ===================================================================================
+// Input Latency Instrumentation for CH551, CH552 and CH554
+// ===================================================================================
+
+#include "latency.h"
+#include "ch554.h"
+#include "scan.h"
+
+// ===================================================================================
+// Variables
+// ===================================================================================
+__xdata struct LAT_stat LAT_stats[LAT_STAGES];  // counters of all stages
+uint16_t LAT_mark;                              // edge time of current event
+uint16_t LAT_markMs;                            // edge time in ms (SCAN_ms)
+__bit LAT_pending;                              // next report belongs to event
+
+// ===================================================================================
+// Clear Counters of one Stage
+// ===================================================================================
+void LAT_clear(__xdata struct LAT_stat *s) {
+  uint8_t i;
+  s->min   = 0xFFFF;
+  s->max   = 0;
+  s->sum   = 0;
+  s->count = 0;
+  for(i = 0; i < LAT_BUCKETS; i++) s->hist[i] = 0;
+}
+
+// ===================================================================================
+// Start Timer2 as free-running Timestamp Counter with Capture on T2EX (Key 1)
+// ===================================================================================
+void LAT_init(void) {
+  uint8_t i;
+  for(i = 0; i < LAT_STAGES; i++) LAT_clear(&LAT_stats[i]);
+  T2MOD  = T2MOD & ~(bT2_CLK | bT2_CAP_M1 | T2OE | bT2_CAP1_EN) | bT2_CAP_M0;
+  T2CON  = 0;                                   // stop Timer2, clear flags
+  TL2    = 0;
+  TH2    = 0;
+  CP_RL2 = 1;                                   // capture mode, no reload
+  EXEN2  = 1;                                   // capture on any T2EX edge
+  TR2    = 1;                                   // start Timer2 (Fsys/12)
+}
+
+// ===================================================================================
+// Read Timer2 (uses only A, DPL, DPH, so it is safe from any context)
+// ===================================================================================
+uint16_t LAT_now(void) __naked {
+  __asm
+    00001$:
+      mov  a, _TH2                  ; high byte
+      mov  dpl, _TL2                ; low byte
+      cjne a, _TH2, 00001$          ; retry if low byte overflowed in between
+      mov  dph, a
+      ret
+  __endasm;
+}
+
+// ===================================================================================
+// Record Latency of one Stage (USB interrupt or IE_USB = 0)
+// ===================================================================================
+#pragma save
+#pragma nooverlay
+void LAT_record(uint8_t stage, uint16_t ticks) {
+  __xdata struct LAT_stat *s = &LAT_stats[stage];
+  uint16_t limit;
+  uint8_t b;
+
+  if(s->count == 0xFFFF) return;                // counters saturated
+  s->count++;
+  s->sum += ticks;
+  if(ticks < s->min) s->min = ticks;
+  if(ticks > s->max) s->max = ticks;
+  for(b = 0, limit = LAT_BUCKET_TICKS; (b < LAT_BUCKETS - 1) && (ticks >= limit); b++)
+    limit <<= 1;
+  s->hist[b]++;
+}
+
+// ===================================================================================
+// Ticks since Edge, 0xFFFF once Timer2 may have wrapped (any context)
+// ===================================================================================
+uint16_t LAT_ticks(uint16_t edge, uint16_t ms) {
+  uint16_t now;
+  __bit et0 = ET0;
+  ET0 = 0;                                      // consistent millisecond count
+  now = SCAN_ms;
+  ET0 = et0;
+  if((uint16_t)(now - ms) >= LAT_WRAP_ms) return 0xFFFF;
+  return LAT_now() - edge;
+}
+#pragma restore
+
+// ===================================================================================
+// Report Stage picks up an Event with the given Edge Time
+// ===================================================================================
+void LAT_start(uint16_t edge, uint16_t ms) {
+  LAT_mark    = edge;
+  LAT_markMs  = ms;
+  LAT_pending = 1;                              // tag next queued report
+  LAT_since(LAT_STAGE_EVENT, edge, ms);
+}
+
+// ===================================================================================
+// Record Time since Edge from the Main Loop
+// ===================================================================================
+void LAT_since(uint8_t stage, uint16_t edge, uint16_t ms) {
+  IE_USB = 0;
+  LAT_record(stage, LAT_ticks(edge, ms));
+  IE_USB = 1;
+}
+
+// ===================================================================================
+// Copy (and optionally clear) Counters of one Stage
+// ===================================================================================
+void LAT_get(uint8_t stage, __xdata struct LAT_stat *dst, uint8_t clear) {
+  __xdata uint8_t *s, *d;
+  uint8_t i;
+  if(stage >= LAT_STAGES) {                     // unknown stage: empty counters
+    LAT_clear(dst);
+    return;
+  }
+  s = (__xdata uint8_t *)&LAT_stats[stage];
+  d = (__xdata uint8_t *)dst;
+  IE_USB = 0;                                   // consistent snapshot
+  for(i = sizeof(struct LAT_stat); i; i--) *d++ = *s++;
+  if(clear) LAT_clear(&LAT_stats[stage]);
+  IE_USB = 1;
+}
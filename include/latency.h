@@ -0,0 +1,67 @@
+// ===================================================================================
+// Input Latency Instrumentation for CH551, CH552 and CH554
+// ===================================================================================
+//
+// Timer2 runs free at Fsys/12 and serves as timestamp source (0.75us per tick at
+// 16 MHz, wraps after 49 ms). The scanner stamps every input event with the time
+// of its pin edge; for key 1 on P1.1/T2EX the edge is captured by hardware into
+// RCAP2, for all other inputs the sample time is used. Each stage of the path
+// from pin edge to USB is then recorded as time since that edge:
+//
+// LAT_STAGE_EVENT  - event taken from the ring by the report stage
+// LAT_STAGE_QUEUE  - first HID report of the event queued by HID_sendReport()
+// LAT_STAGE_USB    - that report fetched by the host (EP1 IN completion)
+//
+// LAT_STAGE_IRQOFF is no input stage, it records how long code in the main loop
+// keeps all interrupts disabled. LAT_STAGE_GAP records how long the pixel line
+// stays low between two pixels of a frame (see LED_update()). LAT_STAGE_COMBO
+// records, for key presses that may start a combo, the time from the edge until
+// the combo was decided.
+//
+// Per stage the counters hold min, max, sum and count (avg = sum / count) and a
+// histogram with LAT_BUCKETS logarithmic buckets: < 250us, < 500us, < 1ms, ...
+// < 16ms, >= 16ms. Counting stops at 65535 events so that sum and count match.
+// Timer2 alone cannot tell a latency of 49 ms or more from a short one, so each
+// edge also carries its SCAN_ms time; from LAT_WRAP_ms on, a latency is recorded
+// as 0xFFFF ticks (last bucket, max and sum saturate at about 49 ms per event).
+//
+// LAT_record() is called from the USB interrupt, so main loop code must only
+// call it with IE_USB = 0.
+
+#pragma once
+#include <stdint.h>
+
+#define LAT_STAGE_EVENT   0                           // edge -> event dequeued
+#define LAT_STAGE_QUEUE   1                           // edge -> report queued
+#define LAT_STAGE_USB     2                           // edge -> report sent
+#define LAT_STAGE_IRQOFF  3                           // interrupts disabled
+#define LAT_STAGE_COMBO   4                           // edge -> combo decided
+#define LAT_STAGE_GAP     5                           // pause between pixels
+#define LAT_STAGES        6                           // number of stages
+
+#define LAT_BUCKETS       8                           // histogram buckets
+#define LAT_TICKS_PER_ms  (FREQ_SYS / 12 / 1000)      // Timer2 ticks per millisecond
+#define LAT_BUCKET_TICKS  (LAT_TICKS_PER_ms / 4)      // upper limit of first bucket
+#define LAT_WRAP_ms       (65536 / LAT_TICKS_PER_ms - 1) // Timer2 may have wrapped
+
+struct LAT_stat {
+  uint16_t min;                                       // min latency in ticks
+  uint16_t max;                                       // max latency in ticks
+  uint32_t sum;                                       // sum of all latencies
+  uint16_t count;                                     // number of recorded events
+  uint16_t hist[LAT_BUCKETS];                         // latency histogram
+};
+
+extern uint16_t LAT_mark;                             // edge time of current event
+extern uint16_t LAT_markMs;                           // edge time in ms (SCAN_ms)
+extern __bit LAT_pending;                             // next report belongs to event
+
+void LAT_init(void);                                  // start Timer2 and clear counters
+uint16_t LAT_now(void);                               // read Timer2 (interrupt safe)
+void LAT_record(uint8_t stage, uint16_t ticks);       // add one latency to a stage
+uint16_t LAT_ticks(uint16_t edge, uint16_t ms);       // ticks since edge, saturated
+void LAT_start(uint16_t edge, uint16_t ms);           // report stage picks up event
+void LAT_since(uint8_t stage, uint16_t edge, uint16_t ms); // record time since edge
+void LAT_get(uint8_t stage, __xdata struct LAT_stat *dst, uint8_t clear);
+
+#define LAT_stop()        LAT_pending = 0             // event handled
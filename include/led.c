@@ -0,0 +1,232 @@
+// ===================================================================================
+// Key LED Functions for CH551, CH552 and CH554
+// ===================================================================================
+
+#include "led.h"
+#include "cfg.h"
+#include "ch554.h"
+#include "neo.h"
+#include "latency.h"
+
+// ===================================================================================
+// Variables
+// ===================================================================================
+__xdata uint8_t LED_color[NEO_COUNT][3];        // r, g, b of each LED
+__xdata uint8_t LED_effect[NEO_COUNT];          // effect of each LED
+__xdata uint8_t LED_speed[NEO_COUNT];           // effect parameter: speed
+__xdata uint8_t LED_rest[NEO_COUNT];            // effect parameter: level
+__xdata uint8_t LED_level[NEO_COUNT];           // brightness envelope of each LED
+__xdata uint8_t LED_phase[NEO_COUNT];           // animation phase of each LED
+__xdata uint8_t LED_hue[3];                     // temp color of rainbow effect
+__xdata uint8_t LED_wire[NEO_COUNT * 3];        // pixel data in wire order
+__xdata uint8_t LED_out[NEO_COUNT * 3];         // wire data scaled by the limiter
+uint8_t LED_brightness = NEO_BRIGHTNESS;        // global brightness
+uint8_t LED_limit = 255;                        // limiter scale of last frame
+__xdata uint8_t LED_back[NEO_COUNT][3];         // stream back buffer
+__xdata struct LED_streamStat LED_streamStat;   // stream statistics
+uint8_t LED_streamSeq;                          // next expected sequence number
+__bit LED_streamPending;                        // back buffer holds a new frame
+__bit LED_dirty;                                // wire buffer differs from pixels
+__bit LED_on;                                   // LEDs currently switched on
+
+// ===================================================================================
+// Render a single LED into the Wire Buffer
+// ===================================================================================
+void LED_render(uint8_t i) {
+  __xdata uint8_t *c = LED_color[i];
+  uint8_t l = LED_on ? LED_level[i] : 0;
+  l = ((uint16_t)l * (LED_brightness + 1)) >> 8; // global brightness
+  if(LED_effect[i] == LED_RAINBOW) {
+    NEO_hueToColor(LED_phase[i], 2, LED_hue);
+    c = LED_hue;
+  }
+  NEO_encodeColor(&LED_wire[i * 3], LED_scale(c[0], l),
+                                    LED_scale(c[1], l),
+                                    LED_scale(c[2], l));
+  LED_dirty = 1;
+}
+
+// ===================================================================================
+// Set global Brightness
+// ===================================================================================
+void LED_setBrightness(uint8_t bright) {
+  uint8_t i;
+  if(bright == LED_brightness) return;
+  LED_brightness = bright;
+  for(i = 0; i < NEO_COUNT; i++) LED_render(i);
+}
+
+// ===================================================================================
+// Set all LEDs to reactive Effect
+// ===================================================================================
+void LED_init(void) {
+  uint8_t i;
+  for(i = 0; i < NEO_COUNT; i++) LED_setEffect(i, LED_REACTIVE, NEO_FADE, NEO_GLOW);
+}
+
+// ===================================================================================
+// Set LED Color
+// ===================================================================================
+void LED_setColor(uint8_t i, uint8_t r, uint8_t g, uint8_t b) {
+  if(i >= NEO_COUNT) return;
+  if(LED_color[i][0] == r && LED_color[i][1] == g && LED_color[i][2] == b) return;
+  LED_color[i][0] = r;
+  LED_color[i][1] = g;
+  LED_color[i][2] = b;
+  LED_render(i);
+}
+
+// ===================================================================================
+// Set LED Effect and its Parameters
+// ===================================================================================
+void LED_setEffect(uint8_t i, uint8_t effect, uint8_t speed, uint8_t level) {
+  if((i >= NEO_COUNT) || (effect >= LED_EFFECTS)) return;
+  if((effect == LED_RAINBOW) && (speed > 191)) speed = 191;
+  LED_effect[i] = effect;
+  LED_speed[i]  = speed;
+  LED_rest[i]   = level;
+  LED_phase[i]  = (effect == LED_RAINBOW) ? i * (192 / NEO_COUNT) : 0;
+  if(effect != LED_FADEOUT) LED_level[i] = level;
+  LED_render(i);
+}
+
+// ===================================================================================
+// Key pressed: raise reactive LED to full Brightness
+// ===================================================================================
+void LED_flash(uint8_t i) {
+  if((i < CFG_LEDS) && (i < NEO_COUNT) && (LED_effect[i] == LED_REACTIVE) && (LED_level[i] != NEO_MAX)) {
+    LED_level[i] = NEO_MAX;
+    LED_render(i);
+  }
+}
+
+// ===================================================================================
+// Stream Frame in Back Buffer complete: swap it in on next Tick
+// ===================================================================================
+void LED_stream(uint8_t seq) {
+  int8_t gap = seq - LED_streamSeq;
+  if(LED_streamStat.received && (gap < 0))      // sequence went back: new stream
+    LED_streamReset();
+  if(LED_streamStat.received)                   // not the first frame?
+    LED_streamStat.dropped += gap;
+  if(LED_streamPending) LED_streamStat.late++;  // previous frame never shown
+  LED_streamStat.received++;
+  LED_streamSeq     = seq + 1;
+  LED_streamPending = 1;
+}
+
+// ===================================================================================
+// Clear Stream Statistics
+// ===================================================================================
+void LED_streamReset(void) {
+  LED_streamStat.received = 0;
+  LED_streamStat.shown    = 0;
+  LED_streamStat.late     = 0;
+  LED_streamStat.dropped  = 0;
+}
+
+// ===================================================================================
+// Advance Effects of all LEDs by one Tick
+// ===================================================================================
+void LED_tick(void) {
+  uint8_t i, l;
+
+  if(LED_streamPending) {                       // swap in streamed frame
+    LED_streamPending = 0;
+    LED_streamStat.shown++;
+    for(i = 0; i < NEO_COUNT; i++) {
+      LED_color[i][0] = LED_back[i][0];
+      LED_color[i][1] = LED_back[i][1];
+      LED_color[i][2] = LED_back[i][2];
+      LED_effect[i]   = LED_STREAM;
+      LED_level[i]    = 255;                    // colors are shown as sent
+      LED_render(i);
+    }
+  }
+
+  for(i = 0; i < NEO_COUNT; i++) {
+    l = LED_level[i];
+    switch(LED_effect[i]) {
+      case LED_BREATHE:
+        LED_phase[i] += LED_speed[i];
+        l = (LED_phase[i] & 0x80) ? ~(LED_phase[i] << 1) : LED_phase[i] << 1;
+        l = LED_rest[i] + LED_scale(NEO_MAX - LED_rest[i], l);
+        break;
+      case LED_RAINBOW:                         // hue wraps at 192
+        if(LED_speed[i] >= 192 - LED_phase[i]) LED_phase[i] -= 192 - LED_speed[i];
+        else LED_phase[i] += LED_speed[i];
+        LED_render(i);                          // color has changed
+        break;
+      case LED_REACTIVE:
+        if(l - LED_rest[i] > LED_speed[i]) l -= LED_speed[i];
+        else l = LED_rest[i];
+        break;
+      case LED_FADEOUT:
+        l = (l > LED_speed[i]) ? l - LED_speed[i] : 0;
+        break;
+      default:
+        break;
+    }
+    if(l != LED_level[i]) {
+      LED_level[i] = l;
+      LED_render(i);
+    }
+  }
+}
+
+// ===================================================================================
+// Write all LEDs if anything has changed
+// ===================================================================================
+// Interrupts are only disabled while a single pixel is clocked out (30us), so
+// an interrupt may delay the next pixel. Pixels latch once the line stays low
+// for their reset time, a longer pause shows the first pixels of a new frame
+// with the rest of the old one. The pixels are assumed to have a reset time of
+// at least 50us (WS2812B, SK6812: 80us, WS2812B-V5: 280us), the USB and Timer0
+// routines are well below that. The interrupt-off windows are recorded as
+// latency stage LAT_STAGE_IRQOFF, the pauses between two pixels, interrupts
+// included, as LAT_STAGE_GAP. The SPI driver does not need interrupts disabled
+// at all.
+//
+// Current limiter: the pixel current is proportional to the gamma corrected
+// channel values, so their sum is compared with the budget. If it is exceeded,
+// the whole frame is scaled with one multiplier into LED_out.
+void LED_update(uint8_t on) {
+  __xdata uint8_t *frame = LED_wire;
+  uint16_t sum = 0;
+  uint8_t i;
+  #ifndef NEO_SPI
+  uint16_t start, end = 0, gap;
+  #endif
+
+  if(on != LED_on) {                            // switched on or off?
+    LED_on = on;
+    for(i = 0; i < NEO_COUNT; i++) LED_render(i);
+  }
+  if(!LED_dirty) return;                        // pixels are up to date
+  LED_dirty = 0;
+
+  for(i = 0; i < sizeof(LED_wire); i++) sum += LED_wire[i];
+  LED_limit = 255;
+  if(sum > LED_BUDGET) {                        // over current budget?
+    LED_limit = ((uint32_t)LED_BUDGET << 8) / sum;
+    for(i = 0; i < sizeof(LED_wire); i++) LED_out[i] = LED_scale(LED_wire[i], LED_limit);
+    frame = LED_out;
+  }
+
+  #ifdef NEO_SPI
+  NEO_sendBuffer(frame, sizeof(LED_wire));
+  #else
+  for(i = 0; i < NEO_COUNT; i++) {
+    EA = 0;                                     // disable interrupts
+    start = LAT_now();
+    gap = start - end;                          // line low since last pixel
+    NEO_sendBuffer(&frame[i * 3], 3);
+    end = LAT_now();
+    EA = 1;                                     // enable interrupts
+    IE_USB = 0;
+    LAT_record(LAT_STAGE_IRQOFF, end - start);
+    if(i) LAT_record(LAT_STAGE_GAP, gap);
+    IE_USB = 1;
+  }
+  #endif
+}
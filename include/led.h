@@ -0,0 +1,102 @@
+// ===================================================================================
+// Key LED Functions for CH551, CH552 and CH554
+// ===================================================================================
+//
+// Each key LED runs one of the effects below, advanced by LED_tick() at a fixed
+// rate (NEO_REFRESH_ms). An effect drives the LED's 8-bit brightness envelope
+// and, for the rainbow, its color. Every effect has two parameters, set with
+// LED_setEffect():
+//
+// LED_STATIC    - constant color at brightness <level>
+// LED_BREATHE   - brightness moves between <level> and NEO_MAX and back,
+//                 <speed> is the phase step per tick (256 steps per breath)
+// LED_RAINBOW   - color runs through the hue wheel at brightness <level>,
+//                 <speed> is the hue step per tick (192 steps per turn)
+// LED_REACTIVE  - glows at <level>, a key press raises it to NEO_MAX, from
+//                 where it fades back by <speed> per tick (default effect)
+// LED_FADEOUT   - fades from its current brightness to off by <speed> per tick
+// LED_STREAM    - shows the colors streamed from the host, set by LED_stream()
+//
+// Streaming: the host fills LED_back with a whole frame and calls LED_stream()
+// with the frame's sequence number. On the next tick the frame is swapped into
+// all LEDs at once, so a frame is never shown half updated. A frame that is
+// overwritten before its tick counts as late, forward gaps in the sequence
+// numbers count as dropped frames. A sequence number going back starts a new
+// stream, which clears the statistics like LED_streamReset(). A frame is one
+// raw HID packet, which limits the chain to LED_COUNT_MAX (10) pixels.
+//
+// A global brightness scales all levels before gamma correction. After that a
+// current limiter estimates the chain's current from the gamma corrected frame
+// and scales the whole frame down if it exceeds NEO_CURRENT_mA (see
+// LED_update()). It costs one addition per channel on every refresh.
+//
+// Cost per pixel: 17 bytes of XRAM (color, effect state, wire, limiter and back
+// buffer), about 30us with interrupts disabled when the chain is written (24
+// bits of 1.25us, one pixel per interrupt-off window; none with NEO_SPI), and
+// one render (3 multiplications, 3 gamma lookups) whenever the pixel changes.
+// The write time of a frame therefore grows linearly with NEO_COUNT.
+//
+// Channels are scaled by the envelope with one 8x8 bit multiplication before
+// NeoPixel gamma correction, no float math. Every change is rendered at once
+// into a gamma corrected wire-order buffer, LED_update() only streams that
+// buffer out if it has changed since the last update.
+//
+// The following must be defined in config.h:
+// NEO_COUNT - number of pixels in the chain (1..10), key LEDs first
+// NEO_GLOW  - default brightness at rest (0..255)
+// NEO_MAX   - brightness on key press (0..255)
+// NEO_FADE  - default brightness decrease per tick
+// NEO_BRIGHTNESS - default global brightness (0..255)
+// NEO_CURRENT_mA - current budget of the pixel chain
+// NEO_CHANNEL_mA - current of one color channel at full brightness
+
+#pragma once
+#include <stdint.h>
+#include "config.h"
+#include "usb_descr.h"
+
+// Pixels of a frame in one raw HID packet (command, sequence number, colors)
+#define LED_COUNT_MAX     ((EP2_SIZE - 2) / 3)
+
+#if NEO_COUNT < 1 || NEO_COUNT > LED_COUNT_MAX
+  #error NEO_COUNT must be 1..10 (a streamed frame is one raw HID packet)!
+#endif
+#if NEO_GLOW > NEO_MAX
+  #error NEO_GLOW must not exceed NEO_MAX!
+#endif
+
+// Effects
+#define LED_STATIC        0
+#define LED_BREATHE       1
+#define LED_RAINBOW       2
+#define LED_REACTIVE      3
+#define LED_FADEOUT       4
+#define LED_STREAM        5
+#define LED_EFFECTS       6                           // number of effects
+
+// Current budget as sum of gamma corrected channel values
+#define LED_BUDGET        ((uint16_t)((uint32_t)NEO_CURRENT_mA * 255 / NEO_CHANNEL_mA))
+
+// Scale color channel (0..255) by brightness (0..255)
+#define LED_scale(c, l)   ((uint8_t)(((uint16_t)(uint8_t)(c) * (uint8_t)(l)) >> 8))
+
+// Streaming statistics
+struct LED_streamStat {
+  uint16_t received;                                  // frames received
+  uint16_t shown;                                     // frames swapped in
+  uint16_t late;                                      // overwritten before tick
+  uint16_t dropped;                                   // missing sequence numbers
+};
+
+extern __xdata uint8_t LED_back[NEO_COUNT][3];        // stream back buffer
+extern __xdata struct LED_streamStat LED_streamStat;  // stream statistics
+
+void LED_init(void);                                  // all LEDs reactive, glowing
+void LED_setColor(uint8_t i, uint8_t r, uint8_t g, uint8_t b); // set LED color
+void LED_setBrightness(uint8_t bright);               // set global brightness
+void LED_setEffect(uint8_t i, uint8_t effect, uint8_t speed, uint8_t level);
+void LED_flash(uint8_t i);                            // key i pressed: flash its LED
+void LED_stream(uint8_t seq);                         // LED_back filled: show on tick
+void LED_streamReset(void);                           // clear stream statistics
+void LED_tick(void);                                  // advance effects of all LEDs
+void LED_update(uint8_t on);                          // write all LEDs (0: all off)
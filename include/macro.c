@@ -0,0 +1,105 @@
+// ===================================================================================
+// Non-blocking Macro Player for CH551, CH552 and CH554
+// ===================================================================================
+
+#include "macro.h"
+#include "scan.h"
+#include "usb_conkbd.h"
+#include "usb_hid.h"
+
+#if MAC_QUEUE_SIZE & (MAC_QUEUE_SIZE - 1)
+  #error MAC_QUEUE_SIZE must be a power of two!
+#endif
+#if KBD_PACK_REPORTS > HID_QUEUE_SIZE
+  #error HID_QUEUE_SIZE too small for a macro step!
+#endif
+
+// ===================================================================================
+// Variables
+// ===================================================================================
+__code uint8_t MAC_data[] = { MAC_DATA, MAC_END };  // all macros, end of list
+__code uint8_t *MAC_ptr;                        // next step, 0: idle
+uint16_t MAC_waitStart;                         // start of running delay
+uint16_t MAC_wait;                              // length of running delay in ms
+__xdata uint8_t MAC_queue[MAC_QUEUE_SIZE];      // macros started during playback
+uint8_t MAC_head, MAC_tail;                     // free running queue indices
+__xdata uint8_t MAC_dropped;                    // starts lost to a full queue
+
+// ===================================================================================
+// Find first Step of Macro n, returns 0 if there is no such macro
+// ===================================================================================
+__code uint8_t *MAC_find(uint8_t n) {
+  __code uint8_t *ptr = MAC_data;
+  uint8_t op;
+
+  while(n) {
+    if(ptr >= MAC_data + sizeof(MAC_data) - 1) return 0;  // beyond last macro
+    op = *ptr++;
+    if(op == MAC_END)               n--;
+    else if(op == MAC_DELAY)        ptr++;      // skip parameters
+    else if(op <= MAC_CONSUMER)     ptr += 2;
+  }
+  return (ptr < MAC_data + sizeof(MAC_data) - 1) ? ptr : 0;
+}
+
+// ===================================================================================
+// Queue Macro
+// ===================================================================================
+uint8_t MAC_start(uint8_t n) {
+  if((uint8_t)(MAC_head - MAC_tail) >= MAC_QUEUE_SIZE) {  // queue is full
+    if(MAC_dropped != 0xFF) MAC_dropped++;
+    return 0;
+  }
+  MAC_queue[MAC_head++ & (MAC_QUEUE_SIZE - 1)] = n;
+  return 1;
+}
+
+// ===================================================================================
+// Play Steps until a Delay or the Report Queue is full
+// ===================================================================================
+void MAC_run(void) {
+  uint8_t op, mod, code;
+
+  while(1) {
+    if(!MAC_ptr) {                              // idle: take next macro
+      if(MAC_head == MAC_tail) return;
+      MAC_ptr = MAC_find(MAC_queue[MAC_tail++ & (MAC_QUEUE_SIZE - 1)]);
+      continue;
+    }
+    if(MAC_wait) {                              // delay running?
+      if(SCAN_millis() - MAC_waitStart < MAC_wait) return;
+      MAC_wait = 0;
+    }
+    if(HID_queueFree() < KBD_PACK_REPORTS) {    // worst case of a step
+      KBD_packFlush();                          // keep no keys half typed for the
+      return;                                   // pad, a pending pack used <= 4
+    }
+
+    op = *MAC_ptr;
+    if((op < MAC_STEPS) && KBD_packPending()) { // type collected keys first
+      KBD_packFlush();
+      continue;
+    }
+    MAC_ptr++;
+    mod  = MAC_ptr[0];
+    code = MAC_ptr[1];
+    switch(op) {
+      case MAC_END:     MAC_ptr = 0; break;
+      case MAC_PRESS:   KBD_code_press(mod, code);   MAC_ptr += 2; break;
+      case MAC_RELEASE: KBD_code_release(mod, code); MAC_ptr += 2; break;
+      case MAC_TAP:     KBD_code_type(mod, code);    MAC_ptr += 2; break;
+      case MAC_CONSUMER:
+        CON_type(((uint16_t)code << 8) | mod);
+        MAC_ptr += 2;
+        break;
+      case MAC_DELAY:
+        MAC_waitStart = SCAN_millis();
+        MAC_wait = (uint16_t)mod * 10;
+        MAC_ptr++;
+        break;
+      default:
+        if(op >= MAC_STEPS) KBD_pack(op);       // key to type, packed
+        break;
+    }
+  }
+}
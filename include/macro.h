@@ -0,0 +1,48 @@
+// ===================================================================================
+// Non-blocking Macro Player for CH551, CH552 and CH554
+// ===================================================================================
+//
+// Macros are step lists in code flash (MAC_DATA in config.h), stored back to
+// back, each one ending with MAC_END. MAC_start() queues a macro by its number,
+// MAC_run() plays the queued macros from the main loop one step at a time as
+// long as the HID report queue has room, so scanning, knob and LEDs keep
+// running during long macros. Macros started during playback wait in a small
+// queue and are played in order; starts that find the queue full are dropped
+// and counted in MAC_dropped (saturates at 255).
+//
+// Steps (parameters follow the opcode):
+// MAC_PRESS   mod, code  - press keyboard usage <code> with modifier bits <mod>
+// MAC_RELEASE mod, code  - release it again
+// MAC_TAP     mod, code  - press and release
+// MAC_CONSUMER lo, hi    - press and release 16-bit consumer usage
+// MAC_DELAY   n          - wait n * 10ms
+// any other byte         - typed like KBD_type(): ASCII character (including
+//                          '\b', '\t', '\n') or KBD_KEY_... from usb_conkbd.h
+//
+// Keys to type are packed into as few reports as possible (see KBD_pack()), a
+// run of up to six distinct keys (16 ascending keys with KBD_NKRO) with the
+// same shift state takes one press and one release report. Collected keys are
+// always typed before MAC_run() returns, so pad keys never send them along.
+//
+// The following must be defined in config.h:
+// MAC_DATA - comma separated steps of all macros (use /* */ comments)
+
+#pragma once
+#include <stdint.h>
+#include "config.h"
+
+#define MAC_QUEUE_SIZE    4                           // queued macros (power of two)
+
+// Step opcodes
+#define MAC_END           0x00                        // end of macro
+#define MAC_PRESS         0x01                        // mod, code
+#define MAC_RELEASE       0x02                        // mod, code
+#define MAC_TAP           0x03                        // mod, code
+#define MAC_CONSUMER      0x04                        // usage low, usage high byte
+#define MAC_DELAY         0x05                        // n * 10ms
+#define MAC_STEPS         0x08                        // first byte typed as key
+
+extern __xdata uint8_t MAC_dropped;                   // starts lost to a full queue
+
+uint8_t MAC_start(uint8_t n);                         // queue macro n, 0 if queue full
+void MAC_run(void);                                   // play steps, call from main loop
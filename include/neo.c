@@ -39,6 +39,8 @@ __code uint8_t gamma8[] = {
   177,180,182,184,186,189,191,193,196,198,200,203,205,208,210,213,
   215,218,220,223,225,228,231,233,236,239,241,244,247,249,252,255 };
 
+#ifndef NEO_SPI
+
 #define NEOPIN PIN_asm(PIN_NEO)     // convert PIN_NEO for inline assembly
 
 // ===================================================================================
@@ -117,6 +119,98 @@ void NEO_sendByte(uint8_t data) {
   __endasm;
 }
 
+// ===================================================================================
+// Send a Buffer of Data Bytes (1..255) to the Pixels String
+// ===================================================================================
+// Same bit timing as NEO_sendByte, but the whole buffer is streamed in a single
+// loop. The buffer must already be in wire order and gamma corrected (see
+// NEO_encodeColor). Interrupts must be disabled as for NEO_sendByte.
+void NEO_sendBuffer(__xdata uint8_t *buf, uint8_t len) {
+  buf;                  // stop unreferenced argument warning
+  len;
+  __asm
+    mov  r6, _NEO_sendBuffer_PARM_2 ; number of bytes to transfer
+    .even
+    02$:
+    movx a, @dptr       ; 1 CLK - data byte -> accu
+    inc  dptr           ; 1 CLK - next byte
+    mov  r7, #8         ; 2 CLK - 8 bits to transfer
+    01$:
+    rlc  a              ; 1 CLK - data bit -> carry (MSB first)
+    setb NEOPIN         ; 2 CLK - NEO pin HIGH
+    mov  NEOPIN, c      ; 2 CLK - "0"-bit? -> NEO pin LOW now
+    T1H_DELAY           ; x CLK - TH1 delay
+    clr  NEOPIN         ; 2 CLK - "1"-bit? -> NEO pin LOW a little later
+    TCT_DELAY           ; y CLK - TCT delay
+    djnz r7, 01$        ; 2/4|5|6 CLK - repeat for all bits
+    djnz r6, 02$        ; 2/4|5|6 CLK - repeat for all bytes
+  __endasm;
+}
+
+#else // NEO_SPI
+
+// ===================================================================================
+// SPI Encoding
+// ===================================================================================
+// Each pixel bit is sent as 4 SPI bits at 3.2 MHz (312ns each): "0" = 1000,
+// "1" = 1110. One SPI byte carries two pixel bits. MOSI rests LOW after every
+// SPI byte, so a gap between two bytes only stretches the LOW time of a bit,
+// which the pixels tolerate up to their latch time.
+#define NEO_SPI_DIV ((FREQ_SYS + 1600000) / 3200000)  // SPI clock divider
+
+__code uint8_t NEO_spiBits[] = {0x88, 0x8E, 0xE8, 0xEE};
+
+// ===================================================================================
+// Setup SPI0 (MOSI only, SCK and MISO stay free for the keys)
+// ===================================================================================
+void NEO_init(void) {
+  PIN_low(P15);
+  PIN_output(P15);
+  SPI0_SETUP  = 0;                              // master mode, MSB first
+  SPI0_CK_SE  = NEO_SPI_DIV;                    // SPI clock ~3.2 MHz
+  SPI0_CTRL   = bS0_MOSI_OE;                    // mode 0, only MOSI output
+  SPI0_DATA   = 0;                              // put MOSI into LOW state
+}
+
+// ===================================================================================
+// Send a Data Byte to the Pixels String
+// ===================================================================================
+// Interrupts may stay enabled, as long as no interrupt routine runs longer than
+// the pixel's latch time.
+void NEO_sendByte(uint8_t data) {
+  uint8_t i, bits;
+  for(i = 4; i; i--) {
+    bits = NEO_spiBits[data >> 6];              // next two pixel bits
+    data <<= 2;
+    while(!S0_FREE);                            // wait for previous SPI byte
+    SPI0_DATA = bits;
+  }
+}
+
+// ===================================================================================
+// Send a Buffer of Data Bytes (1..255) to the Pixels String
+// ===================================================================================
+void NEO_sendBuffer(__xdata uint8_t *buf, uint8_t len) {
+  do {
+    NEO_sendByte(*buf++);
+  } while(--len);
+}
+
+#endif // NEO_SPI
+
+// ===================================================================================
+// Encode Color of a Single Pixel into 3 Bytes of a Send Buffer
+// ===================================================================================
+void NEO_encodeColor(__xdata uint8_t *buf, uint8_t r, uint8_t g, uint8_t b) {
+  #if defined (NEO_GRB)
+    buf[0] = gamma8[g]; buf[1] = gamma8[r]; buf[2] = gamma8[b];
+  #elif defined (NEO_RGB)
+    buf[0] = gamma8[r]; buf[1] = gamma8[g]; buf[2] = gamma8[b];
+  #else
+    #error Wrong or missing NeoPixel type definition!
+  #endif
+}
+
 // ===================================================================================
 // Write Color to a Single Pixel
 // ===================================================================================
@@ -132,16 +226,16 @@ void NEO_writeColor(uint8_t r, uint8_t g, uint8_t b) {
 }
 
 // ===================================================================================
-// Write Hue Value (0..191) and Brightness (0..2) to a Single Pixel
+// Convert Hue Value (0..191) and Brightness (0..2) to r, g, b
 // ===================================================================================
-void NEO_writeHue(uint8_t hue, uint8_t bright) {
+void NEO_hueToColor(uint8_t hue, uint8_t bright, __xdata uint8_t *rgb) {
   uint8_t phase = hue >> 6;
   uint8_t step  = (hue & 63) << bright;
   uint8_t nstep = (63 << bright) - step;
   switch(phase) {
-    case 0:   NEO_writeColor(nstep,  step,     0); break;
-    case 1:   NEO_writeColor(    0, nstep,  step); break;
-    case 2:   NEO_writeColor( step,     0, nstep); break;
+    case 0:   rgb[0] = nstep; rgb[1] =  step; rgb[2] =     0; break;
+    case 1:   rgb[0] =     0; rgb[1] = nstep; rgb[2] =  step; break;
+    case 2:   rgb[0] =  step; rgb[1] =     0; rgb[2] = nstep; break;
     default:  break;
   }
 }
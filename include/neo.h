@@ -10,6 +10,11 @@
 // NEO_GRB - type of pixel: NEO_GRB or NEO_RGB
 // System clock frequency must be at least 6 MHz.
 //
+// With NEO_SPI defined the pixels are driven by the SPI0 peripheral instead of
+// bit-banging PIN_NEO. DATA-IN must then be connected to MOSI (P1.5). The SPI
+// clock pin is not enabled, so P1.6 and P1.7 can still be used as inputs.
+// Interrupts may stay enabled during the transfer.
+//
 // Further information:     https://github.com/wagiminator/ATtiny13-NeoController
 // 2023 by Stefan Wagner:   https://github.com/wagiminator
 
@@ -19,9 +24,15 @@
 #include "delay.h"
 #include "config.h"
 
+#ifdef NEO_SPI
+void NEO_init(void);                                      // init NeoPixels on SPI0 MOSI
+#else
 #define NEO_init()  PIN_low(PIN_NEO);PIN_output(PIN_NEO)  // init NeoPixels
+#endif
 #define NEO_latch() DLY_us(281)                           // latch colors
 
 void NEO_sendByte(uint8_t data);                          // send a single byte to the pixels
+void NEO_sendBuffer(__xdata uint8_t *buf, uint8_t len);   // send wire-order buffer (1..255)
+void NEO_encodeColor(__xdata uint8_t *buf, uint8_t r, uint8_t g, uint8_t b); // color -> 3 wire bytes
 void NEO_writeColor(uint8_t r, uint8_t g, uint8_t b);     // write color to a single pixel
-void NEO_writeHue(uint8_t hue, uint8_t bright);           // hue (0..191), brightness (0..2)
+void NEO_hueToColor(uint8_t hue, uint8_t bright, __xdata uint8_t *rgb); // hue -> r, g, b
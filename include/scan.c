@@ -0,0 +1,147 @@
+// ===================================================================================
+// Fixed-Rate Input Scanner for CH551, CH552 and CH554
+// ===================================================================================
+
+#include "scan.h"
+#include "ch554.h"
+#include "event.h"
+#include "gpio.h"
+#include "latency.h"
+
+// ===================================================================================
+// Variables
+// ===================================================================================
+volatile uint8_t  SCAN_state;                   // debounced state word
+volatile int8_t   SCAN_encDiv = ENC_STEPS_PER_DETENT; // quadrature steps per knob event
+int8_t SCAN_detents;                            // encoder steps not yet queued
+volatile uint16_t SCAN_ms;                      // millisecond counter
+uint8_t SCAN_msDiv;                             // ticks until next millisecond
+uint8_t SCAN_encPrev;                           // last encoder outputs (A<<1 | B)
+int8_t  SCAN_encSteps;                          // quadrature steps within detent
+__xdata uint8_t SCAN_lock[SCAN_KEYS];           // debounce lock counters
+
+// Quadrature decoder: step direction indexed by (previous AB << 2 | current AB).
+// Invalid transitions (both outputs changed, i.e. a missed sample) count as 0.
+__code int8_t SCAN_quadTable[16] = {
+   0, -1, +1,  0,
+  +1,  0,  0, -1,
+  -1,  0,  0, +1,
+   0, +1, -1,  0
+};
+
+// ===================================================================================
+// Setup Pins and start Timer0
+// ===================================================================================
+void SCAN_init(void) {
+  PIN_input_PU(PIN_KEY1);                       // all inputs are active low
+  PIN_input_PU(PIN_KEY2);
+  PIN_input_PU(PIN_KEY3);
+  PIN_input_PU(PIN_ENC_SW);
+  PIN_input_PU(PIN_ENC_A);
+  PIN_input_PU(PIN_ENC_B);
+
+  SCAN_msDiv   = SCAN_TICKS_PER_ms;
+  SCAN_encPrev = (PIN_read(PIN_ENC_A) << 1) | PIN_read(PIN_ENC_B);
+  T2MOD &= ~(bTMR_CLK | bT0_CLK);               // Timer0 clock: Fsys/12
+  TMOD   = TMOD & ~(bT0_GATE | bT0_CT | MASK_T0_MOD) | bT0_M0; // 16-bit timer mode
+  TL0    = (uint8_t)SCAN_RELOAD;
+  TH0    = (uint8_t)(SCAN_RELOAD >> 8);
+  TR0    = 1;                                   // start Timer0
+  ET0    = 1;                                   // enable Timer0 interrupt
+}
+
+// ===================================================================================
+// Get Milliseconds (interrupt is held off while reading the counter)
+// ===================================================================================
+uint16_t SCAN_millis(void) {
+  uint16_t ms;
+  ET0 = 0;
+  ms = SCAN_ms;
+  ET0 = 1;
+  return ms;
+}
+
+// ===================================================================================
+// Timer0 Interrupt Routine
+// ===================================================================================
+#pragma save
+#pragma nooverlay
+void SCAN_interrupt(void) {
+  uint8_t raw, diff, bit, i, ab;
+  uint16_t tick;
+  __xdata struct EVT_event *evt;
+
+  // Add the sample period to the running count, so the next overflow is due
+  // one period after the last one no matter how late this interrupt started.
+  // The timer stops for the add, which is shorter than one tick (12 clocks).
+  TR0  = 0;
+  tick = ((uint16_t)TH0 << 8 | TL0) + SCAN_RELOAD;
+  TL0  = (uint8_t)tick;
+  TH0  = (uint8_t)(tick >> 8);
+  TR0  = 1;
+
+  // Sample all inputs (active low)
+  tick = LAT_now();
+  raw = 0;
+  if(!PIN_read(PIN_KEY1))   raw |= SCAN_KEY1;
+  if(!PIN_read(PIN_KEY2))   raw |= SCAN_KEY2;
+  if(!PIN_read(PIN_KEY3))   raw |= SCAN_KEY3;
+  if(!PIN_read(PIN_ENC_SW)) raw |= SCAN_ENC_SW;
+  ab = (PIN_read(PIN_ENC_A) << 1) | PIN_read(PIN_ENC_B);
+
+  // Debounce keys and queue their edges
+  diff = raw ^ SCAN_state;
+  for(i = 0, bit = 1; i < SCAN_KEYS; i++, bit <<= 1) {
+    if(SCAN_lock[i]) SCAN_lock[i]--;            // still bouncing
+    else if(diff & bit) {                       // state changed?
+      evt = EVT_reserve();
+      if(!evt) continue;                        // queue full: retry next tick
+      evt->type = (raw & bit) ? EVT_KEY_DOWN : EVT_KEY_UP;
+      evt->data = i;
+      evt->time = SCAN_ms;
+      evt->tick = tick;
+      if(!i && EXF2) {                          // key 1: edge captured by Timer2
+        evt->tick = RCAP2;
+        EXF2 = 0;
+      }
+      EVT_commit();
+      SCAN_state  ^= bit;                       // take over new state
+      SCAN_lock[i] = SCAN_DEBOUNCE;             // ignore bounce from now on
+    }
+  }
+
+  // Decode encoder, contact bounce cancels out as alternating +1/-1 steps
+  SCAN_encSteps += SCAN_quadTable[(SCAN_encPrev << 2) | ab];
+  SCAN_encPrev   = ab;
+  if(SCAN_encSteps >= SCAN_encDiv) {
+    SCAN_encSteps -= SCAN_encDiv;
+    if(SCAN_detents != 127) SCAN_detents++;     // clockwise, saturated
+  }
+  else if(SCAN_encSteps <= -SCAN_encDiv) {
+    SCAN_encSteps += SCAN_encDiv;
+    if(SCAN_detents != -127) SCAN_detents--;    // counter-clockwise, saturated
+  }
+  #if ENC_STEPS_PER_DETENT == 4
+  if(ab == 3) SCAN_encSteps = 0;                // resync at rest position
+  #endif
+
+  // Queue encoder detents
+  if(SCAN_detents) {
+    evt = EVT_reserve();
+    if(evt) {                                   // otherwise keep steps pending
+      evt->type = EVT_ENCODER;
+      evt->data = SCAN_detents;
+      evt->time = SCAN_ms;
+      evt->tick = tick;
+      EVT_commit();
+      SCAN_detents = 0;
+    }
+  }
+
+  // Millisecond counter
+  if(!--SCAN_msDiv) {
+    SCAN_msDiv = SCAN_TICKS_PER_ms;
+    SCAN_ms++;
+  }
+}
+#pragma restore
@@ -0,0 +1,58 @@
+// ===================================================================================
+// Fixed-Rate Input Scanner for CH551, CH552 and CH554
+// ===================================================================================
+//
+// Timer0 interrupt samples the keys and the rotary encoder at a fixed rate,
+// debounces them and queues key edges and knob detents as input events (see
+// event.h) for the main loop. The delay between a key edge and its detection
+// is therefore bounded by one sample period, independent of the main loop.
+//
+// Keys are debounced eagerly: the first changed sample is taken over at once,
+// then the key is locked for SCAN_DEBOUNCE_ms so that contact bounce is ignored.
+// The encoder is decoded by a table-driven quadrature state machine which
+// accumulates signed detents until they can be queued. Every transition must
+// be sampled, so SCAN_RATE_HZ limits the spin rate (1 kHz: 250 detents/s with
+// 4 steps each). SCAN_encDiv selects how many steps make one knob event; it
+// is ENC_STEPS_PER_DETENT by default and 1 for high-resolution scrolling.
+// Each event carries the Timer2 time of its edge (see latency.h),
+// LAT_init() has to be called before SCAN_init().
+//
+// The following must be defined in config.h:
+// PIN_KEY1, PIN_KEY2, PIN_KEY3, PIN_ENC_SW, PIN_ENC_A, PIN_ENC_B
+// SCAN_RATE_HZ     - sample rate in Hz (1000..8000, multiple of 1000)
+// SCAN_DEBOUNCE_ms - lock time in ms after a key has changed its state
+// ENC_STEPS_PER_DETENT - quadrature steps per encoder detent (1, 2 or 4)
+//
+// SCAN_interrupt() must be called from the Timer0 interrupt vector, which has
+// to be declared in the main file.
+
+#pragma once
+#include <stdint.h>
+#include "config.h"
+
+// Bits of the debounced state word (1 = pressed)
+#define SCAN_KEY1         0x01
+#define SCAN_KEY2         0x02
+#define SCAN_KEY3         0x04
+#define SCAN_ENC_SW       0x08
+#define SCAN_KEYS         4                           // number of debounced keys
+
+// Timer0 reload value for the selected sample rate (timer clock is Fsys/12)
+#define SCAN_RELOAD       (65536 - (FREQ_SYS / 12 / SCAN_RATE_HZ))
+#define SCAN_TICKS_PER_ms (SCAN_RATE_HZ / 1000)
+#define SCAN_DEBOUNCE     (SCAN_DEBOUNCE_ms * SCAN_TICKS_PER_ms)
+
+#if SCAN_RATE_HZ < 1000 || SCAN_RATE_HZ > 8000 || SCAN_RATE_HZ % 1000
+  #error SCAN_RATE_HZ must be one of 1000, 2000, ... 8000!
+#endif
+#if SCAN_DEBOUNCE > 255
+  #error SCAN_DEBOUNCE_ms too long for the selected SCAN_RATE_HZ!
+#endif
+
+extern volatile uint8_t SCAN_state;                   // debounced state word
+extern volatile uint16_t SCAN_ms;                     // ms counter (read with ET0 = 0)
+extern volatile int8_t SCAN_encDiv;                   // quadrature steps per knob event
+
+void SCAN_init(void);                                 // setup pins and start Timer0
+uint16_t SCAN_millis(void);                           // milliseconds since SCAN_init
+void SCAN_interrupt(void);                            // Timer0 interrupt routine
@@ -2,21 +2,44 @@
 // USB HID Consumer Keyboard Functions for CH551, CH552 and CH554
 // ===================================================================================
 
+#include "config.h"
 #include "usb_conkbd.h"
 #include "usb_handler.h"
 #include "usb_hid.h"
 
-#define KBD_sendReport() HID_sendReport(KBD_report, sizeof(KBD_report))
-#define CON_sendReport() HID_sendReport(CON_report, sizeof(CON_report))
-
 // ===================================================================================
 // Keyboard HID report
 // ===================================================================================
+// With KBD_NKRO, keys below USB_NKRO_KEYS and the modifiers are kept in the
+// bitmap report while the host uses the report protocol, so pressing and
+// releasing is setting and clearing a bit. Other keys, and all keys in boot
+// protocol, use the 6-key array report.
 __xdata uint8_t KBD_report[9] = {
     USB_SEND_REPORT_KEYBOARD_PAGE_ID, 0, 0, 0, 0, 0, 0, 0, 0};
 __xdata uint8_t CON_report[9] = {
     USB_SEND_REPORT_CONSUMER_PAGE_ID, 0, 0, 0, 0, 0, 0, 0, 0};
 
+#ifdef KBD_NKRO
+__xdata uint8_t KBD_nkro[EP1_SIZE] = {USB_SEND_REPORT_NKRO_PAGE_ID, 0};
+#define KBD_nkroOn()        (HID_protocol == HID_PROTOCOL_REPORT)
+#define KBD_inNkro(code)    (KBD_nkroOn() && ((code) < USB_NKRO_KEYS))
+#define KBD_modByte         (*(KBD_nkroOn() ? &KBD_nkro[1] : &KBD_report[1]))
+#else
+#define KBD_nkroOn()        0
+#define KBD_inNkro(code)    0
+#define KBD_modByte         KBD_report[1]
+#endif
+
+#define KBD_ARRAY   0x01    // array report changed
+#define KBD_BITMAP  0x02    // bitmap report changed
+uint8_t KBD_dirty;          // reports to send
+
+// Report packing state of KBD_pack()
+#define KBD_PACK_MAX 16
+__xdata uint8_t KBD_packed[KBD_PACK_MAX]; // keys collected by the packer
+uint8_t KBD_packCount;                    // number of collected keys
+uint8_t KBD_packShift;                    // shift modifier of the collected keys
+
 // ===================================================================================
 // ASCII to keycode mapping table
 // ===================================================================================
@@ -34,69 +57,129 @@ __code uint8_t KBD_map[128] = {
     0x1b, 0x1c, 0x1d, 0xaf, 0xb1, 0xb0, 0xb5, 0x00};
 
 // ===================================================================================
-// Press a key on keyboard
+// Keyboard report state
 // ===================================================================================
-void KBD_press(uint8_t key) {
-  uint8_t i;
 
-  // Convert key for HID report
+// Convert key (ASCII or KBD_KEY_...) to keycode, its modifiers to KBD_keyMod
+uint8_t KBD_keyMod;
+uint8_t KBD_convert(uint8_t key) {
+  KBD_keyMod = 0;
   if (key >= 136)
-    key -= 136;                          // non-printing key/not a modifier?
-  else if (key >= 128) {                 // modifier key?
-    KBD_report[1] |= (1 << (key - 128)); // add modifier to report
-    key = 0;
-  } else {              // printing key?
-    key = KBD_map[key]; // convert ascii to keycode for report
-    if (!key)
-      return;                // no valid key
-    if (key & 0x80) {        // capital letter/shift character?
-      KBD_report[1] |= 0x02; // add left shift modifier
-      key &= 0x7F;           // remove shift from key itself
-    }
+    return key - 136;      // non-printing key/not a modifier?
+  if (key >= 128) {        // modifier key?
+    KBD_keyMod = 1 << (key - 128);
+    return 0;
+  }
+  key = KBD_map[key];      // convert ascii to keycode for report
+  if (key & 0x80) {        // capital letter/shift character?
+    KBD_keyMod = 0x02;     // add left shift modifier
+    key &= 0x7F;           // remove shift from key itself
   }
+  return key;
+}
 
-  // Check if key is already present in report
+// Set or clear modifiers
+void KBD_setMod(uint8_t mod, uint8_t on) {
+  uint8_t old = KBD_modByte;
+  if (on)
+    KBD_modByte |= mod;
+  else
+    KBD_modByte &= ~mod;
+  if (KBD_modByte != old)
+    KBD_dirty |= KBD_nkroOn() ? KBD_BITMAP : KBD_ARRAY;
+}
+
+// Check if keycode is pressed
+uint8_t KBD_hasKey(uint8_t code) {
+  uint8_t i;
+#ifdef KBD_NKRO
+  if (KBD_inNkro(code))
+    return KBD_nkro[2 + (code >> 3)] & (1 << (code & 7));
+#endif
   for (i = 3; i < 9; i++) {
-    if (KBD_report[i] == key)
-      return; // return if already in report
+    if (KBD_report[i] == code)
+      return 1;
   }
+  return 0;
+}
 
-  // Find an empty slot, insert key and transmit report
+// Add keycode to report, returns 0 if there is no room
+uint8_t KBD_addKey(uint8_t code) {
+  uint8_t i;
+#ifdef KBD_NKRO
+  if (KBD_inNkro(code)) {
+    KBD_nkro[2 + (code >> 3)] |= 1 << (code & 7); // set bit
+    KBD_dirty |= KBD_BITMAP;
+    return 1;
+  }
+#endif
+  if (KBD_hasKey(code))
+    return 1; // already in report
   for (i = 3; i < 9; i++) {
     if (KBD_report[i] == 0) { // empty slot?
-      KBD_report[i] = key;    // insert key
-      KBD_sendReport();       // send report
-      return;                 // and return
+      KBD_report[i] = code;   // insert code
+      KBD_dirty |= KBD_ARRAY;
+      return 1;
     }
   }
+  return 0;
 }
 
-// ===================================================================================
-// Release a key on keyboard
-// ===================================================================================
-void KBD_release(uint8_t key) {
+// Delete keycode in report
+void KBD_delKey(uint8_t code) {
   uint8_t i;
-  if (key >= 136)
-    key -= 136;                           // non-printing key/not a modifier?
-  else if (key >= 128) {                  // modifier key?
-    KBD_report[1] &= ~(1 << (key - 128)); // delete modifier in report
-    key = 0;
-  } else {              // printing key?
-    key = KBD_map[key]; // convert ascii to keycode for report
-    if (!key)
-      return;                 // no valid key
-    if (key & 0x80) {         // capital letter/shift character?
-      KBD_report[1] &= ~0x02; // remove shift modifier
-      key &= 0x7F;            // remove shift from key itself
+#ifdef KBD_NKRO
+  if (KBD_inNkro(code)) {
+    KBD_nkro[2 + (code >> 3)] &= ~(1 << (code & 7)); // clear bit
+    KBD_dirty |= KBD_BITMAP;
+    return;
+  }
+#endif
+  for (i = 3; i < 9; i++) {
+    if (KBD_report[i] == code) {
+      KBD_report[i] = 0; // delete code in report
+      KBD_dirty |= KBD_ARRAY;
     }
   }
+}
 
-  // Delete key in report
-  for (i = 3; i < 9; i++) {
-    if (KBD_report[i] == key)
-      KBD_report[i] = 0; // delete key in report
+// Send changed reports, in boot protocol the array report without its ID
+void KBD_send(void) {
+  if (HID_protocol == HID_PROTOCOL_BOOT) {
+    if (KBD_dirty)
+      HID_sendReport(KBD_report + 1, sizeof(KBD_report) - 1);
+    KBD_dirty = 0;
+    return;
   }
-  KBD_sendReport(); // send report
+#ifdef KBD_NKRO
+  if (KBD_dirty & KBD_BITMAP) // modifiers first
+    HID_sendReport(KBD_nkro, sizeof(KBD_nkro));
+#endif
+  if (KBD_dirty & KBD_ARRAY)
+    HID_sendReport(KBD_report, sizeof(KBD_report));
+  KBD_dirty = 0;
+}
+
+// Send consumer report (not understood by boot hosts)
+void CON_sendReport(void) {
+  if (HID_protocol == HID_PROTOCOL_REPORT)
+    HID_sendReport(CON_report, sizeof(CON_report));
+}
+
+// ===================================================================================
+// Press a key on keyboard
+// ===================================================================================
+void KBD_press(uint8_t key) {
+  key = KBD_convert(key);
+  KBD_code_press(KBD_keyMod, key);
+}
+
+// ===================================================================================
+// Release a key on keyboard
+// ===================================================================================
+void KBD_release(uint8_t key) {
+  key = KBD_convert(key);
+  KBD_code_release(KBD_keyMod, key);
 }
 
 // ===================================================================================
@@ -114,61 +197,113 @@ void KBD_releaseAll(void) {
   uint8_t i;
   for (i = 8; i; i--)
     KBD_report[i] = 0; // delete all keys in report
-  KBD_sendReport();    // send report
+  KBD_dirty = KBD_ARRAY;
+#ifdef KBD_NKRO
+  for (i = sizeof(KBD_nkro) - 1; i; i--)
+    KBD_nkro[i] = 0;
+  if (KBD_nkroOn())
+    KBD_dirty |= KBD_BITMAP;
+#endif
+  KBD_send(); // send report
 }
 
+// ===================================================================================
+// Type a key with report packing: typed keys are collected in the report and
+// pressed together by one report, in the order of the array slots or, in the
+// bitmap report, in ascending keycode order. Only a repeated key, a change of
+// the shift state, a key out of order or a full report forces press and
+// release reports, so a run of up to six (bitmap: 16) keys costs two reports
+// instead of two per key. KBD_packFlush() has to be called after the last key.
+// A key held by a key of the pad is released and pressed again, so it is typed
+// and stays held. One call sends up to KBD_PACK_REPORTS reports.
+// ===================================================================================
+void KBD_pack(uint8_t key) {
+  uint8_t code, last;
+
+  code = KBD_convert(key);
+  if (!code) {         // modifier key: type it on its own
+    if (KBD_keyMod) {
+      KBD_packFlush();
+      KBD_type(key);
+    }
+    return;
+  }
+
+  // Press collected keys first if the key cannot join them
+  if (KBD_packCount) {
+    last = KBD_packed[KBD_packCount - 1];
+    if ((KBD_keyMod != KBD_packShift) || (KBD_packCount == KBD_PACK_MAX) ||
+        KBD_hasKey(code) || (KBD_inNkro(code) != KBD_inNkro(last)) ||
+        (KBD_inNkro(code) && (code < last)))
+      KBD_packFlush();
+  }
+
+  // Insert key (press collected keys if the array is full)
+  if (KBD_hasKey(code)) { // held by a key of the pad (collected keys are typed)
+    KBD_delKey(code);
+    KBD_send();
+    KBD_setMod(KBD_keyMod, 1);
+    KBD_addKey(code);
+    KBD_send();
+    KBD_setMod(KBD_keyMod, 0);
+    KBD_send();
+    return;
+  }
+  if (!KBD_addKey(code)) {
+    KBD_packFlush();
+    if (!KBD_addKey(code))
+      return; // array full of held keys
+  }
+  KBD_setMod(KBD_keyMod, 1);
+  KBD_packShift = KBD_keyMod;
+  KBD_packed[KBD_packCount++] = code;
+}
+
+// ===================================================================================
+// Press and release the keys collected by KBD_pack()
+// ===================================================================================
+void KBD_packFlush(void) {
+  uint8_t i;
+
+  if (!KBD_packCount)
+    return;   // nothing collected
+  KBD_send(); // press all collected keys at once
+  for (i = 0; i < KBD_packCount; i++)
+    KBD_delKey(KBD_packed[i]);
+  KBD_setMod(KBD_packShift, 0);
+  KBD_packCount = 0;
+  KBD_send(); // release them
+}
+
+uint8_t KBD_packPending(void) { return KBD_packCount; }
+
 // ===================================================================================
 // Write text with keyboard
 // ===================================================================================
 void KBD_print(char *str) {
   while (*str)
-    KBD_type(*str++);
+    KBD_pack(*str++);
+  KBD_packFlush();
 }
 
 // ===================================================================================
 // Press with modifier and keycode
 // ===================================================================================
 void KBD_code_press(uint8_t mod, uint8_t code) {
-  uint8_t i;
-
-  if (!code)
-    return; // no valid code
-
-  KBD_report[1] |= mod; // add modifiers
-
-  // Check if code is already present in report
-  for (i = 3; i < 9; i++) {
-    if (KBD_report[i] == code)
-      return; // return if already in report
-  }
-
-  // Find an empty slot, insert code and transmit report
-  for (i = 3; i < 9; i++) {
-    if (KBD_report[i] == 0) { // empty slot?
-      KBD_report[i] = code;   // insert code
-      KBD_sendReport();       // send report
-      return;                 // and return
-    }
-  }
+  KBD_setMod(mod, 1); // add modifiers
+  if (code)
+    KBD_addKey(code); // insert code
+  KBD_send();         // send report
 }
 
 // ===================================================================================
 // Release with modifier and keycode
 // ===================================================================================
 void KBD_code_release(uint8_t mod, uint8_t code) {
-  uint8_t i;
-
-  if (!code)
-    return; // no valid code
-
-  KBD_report[1] &= ~mod; // remove modifiers
-
-  // Delete code in report
-  for (i = 3; i < 9; i++) {
-    if (KBD_report[i] == code)
-      KBD_report[i] = 0; // delete code in report
-  }
-  KBD_sendReport(); // send report
+  KBD_setMod(mod, 0); // remove modifiers
+  if (code)
+    KBD_delKey(code); // delete code in report
+  KBD_send();         // send report
 }
 
 // ===================================================================================
@@ -236,6 +371,54 @@ void CON_releaseAll(void) {
   CON_sendReport();    // send report
 }
 
+#ifdef MOUSE_WHEEL
+// ===================================================================================
+// Mouse wheel report
+// ===================================================================================
+// Wheel and AC Pan movement is accumulated and sent by MOU_send() only when no
+// other report is queued, so while the host is slower than the knob the steps
+// of several polls are merged into one report instead of flooding the queue.
+// Units are detents, or fractions of a detent when the host has set the
+// Resolution Multiplier (HID_feature). Boot hosts get no mouse reports.
+__xdata uint8_t MOU_report[6] = {USB_SEND_REPORT_MOUSE_PAGE_ID, 0, 0, 0, 0, 0};
+int16_t MOU_wheel; // wheel movement not yet sent
+int16_t MOU_pan;   // AC Pan movement not yet sent
+
+// Clamp accumulated movement to one report field and keep the rest
+int8_t MOU_take(int16_t *acc) {
+  int8_t d;
+  if (*acc > 127)
+    d = 127;
+  else if (*acc < -127)
+    d = -127;
+  else
+    d = *acc;
+  *acc -= d;
+  return d;
+}
+
+// ===================================================================================
+// Add wheel and AC Pan movement
+// ===================================================================================
+void MOU_scroll(int16_t wheel, int16_t pan) {
+  if (HID_protocol == HID_PROTOCOL_BOOT)
+    return;
+  MOU_wheel += wheel;
+  MOU_pan += pan;
+}
+
+// ===================================================================================
+// Send accumulated movement, at most one report per poll
+// ===================================================================================
+void MOU_send(void) {
+  if (!(MOU_wheel | MOU_pan) || HID_queueFree() < HID_QUEUE_SIZE)
+    return;
+  MOU_report[4] = MOU_take(&MOU_wheel);
+  MOU_report[5] = MOU_take(&MOU_pan);
+  HID_sendReport(MOU_report, sizeof(MOU_report));
+}
+#endif
+
 // ===================================================================================
 // Get keyboard status LEDs
 // ===================================================================================
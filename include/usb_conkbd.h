@@ -13,6 +13,10 @@ void KBD_release(uint8_t key);        // release a key on keyboard
 void KBD_type(uint8_t key);           // press and release a key on keyboard
 void KBD_releaseAll(void);            // release all keys on keyboard
 void KBD_print(char* str);            // type some text on the keyboard
+#define KBD_PACK_REPORTS 8            // reports one KBD_pack() may queue at most
+void KBD_pack(uint8_t key);           // type a key, packed with the following ones
+void KBD_packFlush(void);             // press and release keys collected by KBD_pack
+uint8_t KBD_packPending(void);        // keys collected by KBD_pack not yet typed
 
 void KBD_code_press(uint8_t mod, uint8_t code);
 void KBD_code_release(uint8_t mod, uint8_t code);
@@ -23,6 +27,9 @@ void CON_release(uint16_t key);       // release a consumer key on keyboard
 void CON_type(uint16_t key);          // press and release a consumer key
 void CON_releaseAll(void);            // release all consumer keys on keyboard
 
+void MOU_scroll(int16_t wheel, int16_t pan); // add wheel and AC Pan movement
+void MOU_send(void);                  // send accumulated movement, once per poll
+
 uint8_t KBD_getState(void);           // get keyboard status LEDs
 
 // Keyboard LED states
@@ -28,99 +28,119 @@ __code USB_DEV_DESCR DevDescr = {
 // ===================================================================================
 // Configuration Descriptor
 // ===================================================================================
-__code USB_CFG_DESCR_HID CfgDescr = {
-
-  // Configuration Descriptor
-  .config = {
-    .bLength            = sizeof(USB_CFG_DESCR),  // size of the descriptor in bytes
-    .bDescriptorType    = USB_DESCR_TYP_CONFIG,   // configuration descriptor: 0x02
-    .wTotalLength       = sizeof(CfgDescr),       // total length in bytes
-    .bNumInterfaces     = 2,                      // number of interfaces: 2
-    .bConfigurationValue= 1,                      // value to select this configuration
-    .iConfiguration     = 0,                      // no configuration string descriptor
-    .bmAttributes       = 0x80,                   // attributes = bus powered, no wakeup
-    .MaxPower           = USB_MAX_POWER_mA / 2    // in 2mA units
-  },
-
-  // Interface Descriptor
-  .HIDInterface = {
-    .bLength            = sizeof(USB_ITF_DESCR),  // size of the descriptor in bytes: 9
-    .bDescriptorType    = USB_DESCR_TYP_INTERF,   // interface descriptor: 0x04
-    .bInterfaceNumber   = 0,                      // number of this interface: 0
-    .bAlternateSetting  = 0,                      // value used to select alternative setting
-    .bNumEndpoints      = 2,                      // number of endpoints used: 2
-    .bInterfaceClass    = USB_DEV_CLASS_HID,      // interface class: HID (0x03)
-    .bInterfaceSubClass = 1,                      // boot interface
-    .bInterfaceProtocol = 1,                      // keyboard
-    .iInterface         = 4                       // interface string descriptor
-  },
-
-  // HID Descriptor
-  .hid0 = {
-    .bLength            = sizeof(USB_HID_DESCR),  // size of the descriptor in bytes: 9
-    .bDescriptorType    = USB_DESCR_TYP_HID,      // HID descriptor: 0x21
-    .bcdHID             = 0x0110,                 // HID class spec version (BCD: 1.1)
-    .bCountryCode       = 33,                     // country code: US
-    .bNumDescriptors    = 1,                      // number of report descriptors: 1
-    .bDescriptorTypeX   = 34,                     // descriptor type: report
-    .wDescriptorLength  = sizeof(ReportDescr)     // report descriptor length
-  },
-
-  // Endpoint Descriptor: Endpoint 1 (IN, Interrupt)
-  .ep1IN = {
-    .bLength            = sizeof(USB_ENDP_DESCR), // size of the descriptor in bytes: 7
-    .bDescriptorType    = USB_DESCR_TYP_ENDP,     // endpoint descriptor: 0x05
-    .bEndpointAddress   = USB_ENDP_ADDR_EP1_IN,   // endpoint: 1, direction: IN (0x81)
-    .bmAttributes       = USB_ENDP_TYPE_INTER,    // transfer type: interrupt (0x03)
-    .wMaxPacketSize     = EP1_SIZE,               // max packet size
-    .bInterval          = 10                      // polling intervall in ms
-  },
-
-  // Endpoint Descriptor: Endpoint 1 (OUT, Interrupt)
-  .ep1OUT = {
-    .bLength            = sizeof(USB_ENDP_DESCR), // size of the descriptor in bytes: 7
-    .bDescriptorType    = USB_DESCR_TYP_ENDP,     // endpoint descriptor: 0x05
-    .bEndpointAddress   = USB_ENDP_ADDR_EP1_OUT,  // endpoint: 1, direction: OUT (0x02)
-    .bmAttributes       = USB_ENDP_TYPE_INTER,    // transfer type: interrupt (0x03)
-    .wMaxPacketSize     = EP1_SIZE,               // max packet size
-    .bInterval          = 10                      // polling intervall in ms
-  },
-  
-   .RawInterface = {
-    .bLength            = sizeof(USB_ITF_DESCR),  // size of the descriptor in bytes: 9
-    .bDescriptorType    = USB_DESCR_TYP_INTERF,   // interface descriptor: 0x04
-    .bInterfaceNumber   = 1,                      // number of this interface: 0
-    .bAlternateSetting  = 0,                      // value used to select alternative setting
-    .bNumEndpoints      = 1,                      // number of endpoints used: 2
-    .bInterfaceClass    = USB_DEV_CLASS_HID,      // interface class: HID (0x03)
-    .bInterfaceSubClass = 0,                      // no boot interface
-    .bInterfaceProtocol = 0,                      //  interface does not belong to a HID boot protocol.
-    .iInterface         = 0                       // no interface string descriptor
-  },
-
-  // HID Descriptor
-  .RawHid1 = {
-    .bLength            = sizeof(USB_HID_DESCR),  // size of the descriptor in bytes: 9
-    .bDescriptorType    = USB_DESCR_TYP_HID,      // HID descriptor: 0x21
-    .bcdHID             = 0x0110,                 // HID class spec version (BCD: 1.1)
-    .bCountryCode       = 33,                     // country code: US
-    .bNumDescriptors    = 1,                      // number of report descriptors: 1
-    .bDescriptorTypeX   = 34,                     // descriptor type: report
-    .wDescriptorLength  = sizeof(RawHIDReportDescriptor)     // report descriptor length
-  },
-
-  // Endpoint Descriptor: Endpoint 2 (OUT, Interrupt)
-  .ep2OUT = {
-    .bLength            = sizeof(USB_ENDP_DESCR), // size of the descriptor in bytes: 7
-    .bDescriptorType    = USB_DESCR_TYP_ENDP,     // endpoint descriptor: 0x05
-    .bEndpointAddress   = USB_ENDP_ADDR_EP2_OUT,  // endpoint: 1, direction: OUT (0x02)
-    .bmAttributes       = USB_ENDP_TYPE_INTER,    // transfer type: interrupt (0x03)
-    .wMaxPacketSize     = EP2_SIZE,               // max packet size
-    .bInterval          = 10                      // polling intervall in ms
-  },
+// The descriptor is generated once per polling profile, they only differ in the
+// endpoint polling intervals. USB_cfgDescr selects the one used for enumeration.
+#define CFG_DESCR_HID(KBD_ms, RAW_ms) {                                              \
+                                                                                     \
+  /* Configuration Descriptor */                                                     \
+  .config = {                                                                        \
+    .bLength            = sizeof(USB_CFG_DESCR),  /* size of the descriptor in bytes */ \
+    .bDescriptorType    = USB_DESCR_TYP_CONFIG,   /* configuration descriptor: 0x02 */ \
+    .wTotalLength       = sizeof(USB_CFG_DESCR_HID), /* total length in bytes */     \
+    .bNumInterfaces     = 2,                      /* number of interfaces: 2 */      \
+    .bConfigurationValue= 1,                      /* value to select this configuration */ \
+    .iConfiguration     = 0,                      /* no configuration string descriptor */ \
+    .bmAttributes       = 0x80,                   /* attributes = bus powered, no wakeup */ \
+    .MaxPower           = USB_MAX_POWER_mA / 2    /* in 2mA units */                 \
+  },                                                                                 \
+                                                                                     \
+  /* Interface Descriptor */                                                         \
+  .HIDInterface = {                                                                  \
+    .bLength            = sizeof(USB_ITF_DESCR),  /* size of the descriptor in bytes: 9 */ \
+    .bDescriptorType    = USB_DESCR_TYP_INTERF,   /* interface descriptor: 0x04 */   \
+    .bInterfaceNumber   = 0,                      /* number of this interface: 0 */  \
+    .bAlternateSetting  = 0,                      /* value used to select alternative setting */ \
+    .bNumEndpoints      = 2,                      /* number of endpoints used: 2 */  \
+    .bInterfaceClass    = USB_DEV_CLASS_HID,      /* interface class: HID (0x03) */  \
+    .bInterfaceSubClass = 1,                      /* boot interface */               \
+    .bInterfaceProtocol = 1,                      /* keyboard */                     \
+    .iInterface         = 4                       /* interface string descriptor */  \
+  },                                                                                 \
+                                                                                     \
+  /* HID Descriptor */                                                               \
+  .hid0 = {                                                                          \
+    .bLength            = sizeof(USB_HID_DESCR),  /* size of the descriptor in bytes: 9 */ \
+    .bDescriptorType    = USB_DESCR_TYP_HID,      /* HID descriptor: 0x21 */         \
+    .bcdHID             = 0x0110,                 /* HID class spec version (BCD: 1.1) */ \
+    .bCountryCode       = 33,                     /* country code: US */             \
+    .bNumDescriptors    = 1,                      /* number of report descriptors: 1 */ \
+    .bDescriptorTypeX   = 34,                     /* descriptor type: report */      \
+    .wDescriptorLength  = sizeof(ReportDescr)     /* report descriptor length */     \
+  },                                                                                 \
+                                                                                     \
+  /* Endpoint Descriptor: Endpoint 1 (IN, Interrupt) */                              \
+  .ep1IN = {                                                                         \
+    .bLength            = sizeof(USB_ENDP_DESCR), /* size of the descriptor in bytes: 7 */ \
+    .bDescriptorType    = USB_DESCR_TYP_ENDP,     /* endpoint descriptor: 0x05 */    \
+    .bEndpointAddress   = USB_ENDP_ADDR_EP1_IN,   /* endpoint: 1, direction: IN (0x81) */ \
+    .bmAttributes       = USB_ENDP_TYPE_INTER,    /* transfer type: interrupt (0x03) */ \
+    .wMaxPacketSize     = EP1_SIZE,               /* max packet size */              \
+    .bInterval          = KBD_ms                  /* polling intervall in ms */      \
+  },                                                                                 \
+                                                                                     \
+  /* Endpoint Descriptor: Endpoint 1 (OUT, Interrupt) */                             \
+  .ep1OUT = {                                                                        \
+    .bLength            = sizeof(USB_ENDP_DESCR), /* size of the descriptor in bytes: 7 */ \
+    .bDescriptorType    = USB_DESCR_TYP_ENDP,     /* endpoint descriptor: 0x05 */    \
+    .bEndpointAddress   = USB_ENDP_ADDR_EP1_OUT,  /* endpoint: 1, direction: OUT (0x01) */ \
+    .bmAttributes       = USB_ENDP_TYPE_INTER,    /* transfer type: interrupt (0x03) */ \
+    .wMaxPacketSize     = EP1_SIZE,               /* max packet size */              \
+    .bInterval          = KBD_ms                  /* polling intervall in ms */      \
+  },                                                                                 \
+                                                                                     \
+  /* Interface Descriptor: Raw HID */                                                \
+  .RawInterface = {                                                                  \
+    .bLength            = sizeof(USB_ITF_DESCR),  /* size of the descriptor in bytes: 9 */ \
+    .bDescriptorType    = USB_DESCR_TYP_INTERF,   /* interface descriptor: 0x04 */   \
+    .bInterfaceNumber   = 1,                      /* number of this interface: 1 */  \
+    .bAlternateSetting  = 0,                      /* value used to select alternative setting */ \
+    .bNumEndpoints      = 2,                      /* number of endpoints used: 2 */  \
+    .bInterfaceClass    = USB_DEV_CLASS_HID,      /* interface class: HID (0x03) */  \
+    .bInterfaceSubClass = 0,                      /* no boot interface */            \
+    .bInterfaceProtocol = 0,                      /* interface does not belong to a HID boot protocol */ \
+    .iInterface         = 0                       /* no interface string descriptor */ \
+  },                                                                                 \
+                                                                                     \
+  /* HID Descriptor */                                                               \
+  .RawHid1 = {                                                                       \
+    .bLength            = sizeof(USB_HID_DESCR),  /* size of the descriptor in bytes: 9 */ \
+    .bDescriptorType    = USB_DESCR_TYP_HID,      /* HID descriptor: 0x21 */         \
+    .bcdHID             = 0x0110,                 /* HID class spec version (BCD: 1.1) */ \
+    .bCountryCode       = 33,                     /* country code: US */             \
+    .bNumDescriptors    = 1,                      /* number of report descriptors: 1 */ \
+    .bDescriptorTypeX   = 34,                     /* descriptor type: report */      \
+    .wDescriptorLength  = sizeof(RawHIDReportDescriptor) /* report descriptor length */ \
+  },                                                                                 \
+                                                                                     \
+  /* Endpoint Descriptor: Endpoint 2 (OUT, Interrupt) */                             \
+  .ep2OUT = {                                                                        \
+    .bLength            = sizeof(USB_ENDP_DESCR), /* size of the descriptor in bytes: 7 */ \
+    .bDescriptorType    = USB_DESCR_TYP_ENDP,     /* endpoint descriptor: 0x05 */    \
+    .bEndpointAddress   = USB_ENDP_ADDR_EP2_OUT,  /* endpoint: 2, direction: OUT (0x02) */ \
+    .bmAttributes       = USB_ENDP_TYPE_INTER,    /* transfer type: interrupt (0x03) */ \
+    .wMaxPacketSize     = EP2_SIZE,               /* max packet size */              \
+    .bInterval          = RAW_ms                  /* polling intervall in ms */      \
+  },                                                                                 \
+                                                                                     \
+  /* Endpoint Descriptor: Endpoint 2 (IN, Interrupt) */                              \
+  .ep2IN = {                                                                         \
+    .bLength            = sizeof(USB_ENDP_DESCR), /* size of the descriptor in bytes: 7 */ \
+    .bDescriptorType    = USB_DESCR_TYP_ENDP,     /* endpoint descriptor: 0x05 */    \
+    .bEndpointAddress   = USB_ENDP_ADDR_EP2_IN,   /* endpoint: 2, direction: IN (0x82) */ \
+    .bmAttributes       = USB_ENDP_TYPE_INTER,    /* transfer type: interrupt (0x03) */ \
+    .wMaxPacketSize     = EP2_SIZE,               /* max packet size */              \
+    .bInterval          = RAW_ms                  /* polling intervall in ms */      \
+  }                                                                                  \
+}
 
+// Standard profile: all endpoints polled every USB_POLL_ms
+__code USB_CFG_DESCR_HID CfgDescr = CFG_DESCR_HID(USB_POLL_ms, USB_POLL_ms);
 
-};
+// Low-latency profile: keyboard every USB_POLL_FAST_ms, raw HID every USB_POLL_RAW_ms
+__code USB_CFG_DESCR_HID CfgDescrFast = CFG_DESCR_HID(USB_POLL_FAST_ms, USB_POLL_RAW_ms);
+
+// Descriptor used for enumeration, select with USB_setProfile() before USB_init()
+__code USB_CFG_DESCR_HID *USB_cfgDescr = &CfgDescr;
 
 // ===================================================================================
 // HID Report Descriptor
@@ -172,9 +192,98 @@ __code uint8_t ReportDescr[] ={
     0x95, 0x04,                    //   REPORT_COUNT (4)
     0x75, 0x10,                    //   REPORT_SIZE (16)
     0x81, 0x00,                    //   INPUT (Data,Ary,Abs)
-    0xc0                           // END_COLLECTION
+    0xc0,                          // END_COLLECTION
+#ifdef KBD_NKRO
+    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
+    0x09, 0x06,                    // USAGE (Keyboard)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x85, USB_SEND_REPORT_NKRO_PAGE_ID,                        //   REPORT_ID (3)
+    0x05, 0x07,                    //   USAGE_PAGE (Keyboard)
+    0x19, 0xe0,                    //   USAGE_MINIMUM (Keyboard LeftControl)
+    0x29, 0xe7,                    //   USAGE_MAXIMUM (Keyboard Right GUI)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
+    0x95, 0x08,                    //   REPORT_COUNT (8)
+    0x75, 0x01,                    //   REPORT_SIZE (1)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0x19, 0x00,                    //   USAGE_MINIMUM (Reserved (no event indicated))
+    0x29, USB_NKRO_KEYS - 1,       //   USAGE_MAXIMUM (Keyboard F20)
+    0x95, USB_NKRO_KEYS,           //   REPORT_COUNT (112)
+    0x75, 0x01,                    //   REPORT_SIZE (1)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+    0xc0,                          // END_COLLECTION
+#endif
+#ifdef MOUSE_WHEEL
+    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
+    0x09, 0x02,                    // USAGE (Mouse)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x85, USB_SEND_REPORT_MOUSE_PAGE_ID,                       //   REPORT_ID (4)
+    0x09, 0x01,                    //   USAGE (Pointer)
+    0xa1, 0x00,                    //   COLLECTION (Physical)
+    0x05, 0x09,                    //     USAGE_PAGE (Button)
+    0x19, 0x01,                    //     USAGE_MINIMUM (Button 1)
+    0x29, 0x03,                    //     USAGE_MAXIMUM (Button 3)
+    0x15, 0x00,                    //     LOGICAL_MINIMUM (0)
+    0x25, 0x01,                    //     LOGICAL_MAXIMUM (1)
+    0x95, 0x03,                    //     REPORT_COUNT (3)
+    0x75, 0x01,                    //     REPORT_SIZE (1)
+    0x81, 0x02,                    //     INPUT (Data,Var,Abs)
+    0x95, 0x01,                    //     REPORT_COUNT (1)
+    0x75, 0x05,                    //     REPORT_SIZE (5)
+    0x81, 0x03,                    //     INPUT (Cnst,Var,Abs)
+    0x05, 0x01,                    //     USAGE_PAGE (Generic Desktop)
+    0x09, 0x30,                    //     USAGE (X)
+    0x09, 0x31,                    //     USAGE (Y)
+    0x15, 0x81,                    //     LOGICAL_MINIMUM (-127)
+    0x25, 0x7f,                    //     LOGICAL_MAXIMUM (127)
+    0x75, 0x08,                    //     REPORT_SIZE (8)
+    0x95, 0x02,                    //     REPORT_COUNT (2)
+    0x81, 0x06,                    //     INPUT (Data,Var,Rel)
+    0xa1, 0x02,                    //     COLLECTION (Logical)
+    0x09, 0x48,                    //       USAGE (Resolution Multiplier)
+    0x15, 0x00,                    //       LOGICAL_MINIMUM (0)
+    0x25, 0x01,                    //       LOGICAL_MAXIMUM (1)
+    0x35, 0x01,                    //       PHYSICAL_MINIMUM (1)
+    0x45, ENC_STEPS_PER_DETENT,    //       PHYSICAL_MAXIMUM (steps per detent)
+    0x75, 0x02,                    //       REPORT_SIZE (2)
+    0x95, 0x01,                    //       REPORT_COUNT (1)
+    0xb1, 0x02,                    //       FEATURE (Data,Var,Abs)
+    0x35, 0x00,                    //       PHYSICAL_MINIMUM (0)
+    0x45, 0x00,                    //       PHYSICAL_MAXIMUM (0)
+    0x09, 0x38,                    //       USAGE (Wheel)
+    0x15, 0x81,                    //       LOGICAL_MINIMUM (-127)
+    0x25, 0x7f,                    //       LOGICAL_MAXIMUM (127)
+    0x75, 0x08,                    //       REPORT_SIZE (8)
+    0x95, 0x01,                    //       REPORT_COUNT (1)
+    0x81, 0x06,                    //       INPUT (Data,Var,Rel)
+    0xc0,                          //     END_COLLECTION
+    0xa1, 0x02,                    //     COLLECTION (Logical)
+    0x09, 0x48,                    //       USAGE (Resolution Multiplier)
+    0x15, 0x00,                    //       LOGICAL_MINIMUM (0)
+    0x25, 0x01,                    //       LOGICAL_MAXIMUM (1)
+    0x35, 0x01,                    //       PHYSICAL_MINIMUM (1)
+    0x45, ENC_STEPS_PER_DETENT,    //       PHYSICAL_MAXIMUM (steps per detent)
+    0x75, 0x02,                    //       REPORT_SIZE (2)
+    0x95, 0x01,                    //       REPORT_COUNT (1)
+    0xb1, 0x02,                    //       FEATURE (Data,Var,Abs)
+    0x35, 0x00,                    //       PHYSICAL_MINIMUM (0)
+    0x45, 0x00,                    //       PHYSICAL_MAXIMUM (0)
+    0x05, 0x0c,                    //       USAGE_PAGE (Consumer Devices)
+    0x0a, 0x38, 0x02,              //       USAGE (AC Pan)
+    0x15, 0x81,                    //       LOGICAL_MINIMUM (-127)
+    0x25, 0x7f,                    //       LOGICAL_MAXIMUM (127)
+    0x75, 0x08,                    //       REPORT_SIZE (8)
+    0x95, 0x01,                    //       REPORT_COUNT (1)
+    0x81, 0x06,                    //       INPUT (Data,Var,Rel)
+    0xc0,                          //     END_COLLECTION
+    0x75, 0x04,                    //     REPORT_SIZE (4)
+    0x95, 0x01,                    //     REPORT_COUNT (1)
+    0xb1, 0x03,                    //     FEATURE (Cnst,Var,Abs)
+    0xc0,                          //   END_COLLECTION
+    0xc0,                          // END_COLLECTION
+#endif
 };
-__code uint8_t ReportDescrLen = sizeof(ReportDescr);
+__code uint16_t ReportDescrLen = sizeof(ReportDescr);
 
 
 __code uint8_t RawHIDReportDescriptor[] = {
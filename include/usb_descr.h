@@ -9,6 +9,8 @@
 // USB_PRODUCT_ID           - Product ID (16-bit word)
 // USB_DEVICE_VERSION       - Device version (16-bit BCD)
 // USB_MAX_POWER_mA         - Device max power in mA
+// KBD_NKRO                 - optional, adds the N-key rollover bitmap report
+// MOUSE_WHEEL              - optional, adds the wheel/AC Pan mouse report
 // HID_COUNTRY_CODE         - Country Code
 // All string descriptors.
 
@@ -21,7 +23,7 @@
 // ===================================================================================
 #define EP0_SIZE        64
 #define EP1_SIZE        16
-#define EP2_SIZE        16
+#define EP2_SIZE        32
 
 #define EP0_ADDR        0
 #define EP1_ADDR        (EP0_ADDR + EP0_BUF_SIZE)
@@ -33,6 +35,11 @@
 
 #define EP_BUF_SIZE(x)  (x+2<64 ? x+2 : 64)
 
+// Variables in XRAM start right behind the last endpoint buffer (EP2 IN)
+#if defined(XRAM_LOC) && (XRAM_LOC < EP2_ADDR + 64 + EP2_BUF_SIZE)
+  #error XRAM_LOC overlaps the endpoint buffers!
+#endif
+
 // ===================================================================================
 // Device and Configuration Descriptors
 // ===================================================================================
@@ -45,17 +52,25 @@ typedef struct _USB_CFG_DESCR_HID {
   USB_ITF_DESCR RawInterface;
   USB_HID_DESCR RawHid1;
   USB_ENDP_DESCR ep2OUT;
+  USB_ENDP_DESCR ep2IN;
 } USB_CFG_DESCR_HID, *PUSB_CFG_DESCR_HID;
 typedef USB_CFG_DESCR_HID __xdata *PXUSB_CFG_DESCR_HID;
 
 extern __code USB_DEV_DESCR DevDescr;
 extern __code USB_CFG_DESCR_HID CfgDescr;
+extern __code USB_CFG_DESCR_HID CfgDescrFast;
+extern __code USB_CFG_DESCR_HID *USB_cfgDescr;
+
+// Polling profiles, select before USB_init()
+#define USB_PROFILE_STANDARD  0                         // all endpoints at USB_POLL_ms
+#define USB_PROFILE_FAST      1                         // keyboard at USB_POLL_FAST_ms
+#define USB_setProfile(p)     USB_cfgDescr = ((p) == USB_PROFILE_FAST) ? &CfgDescrFast : &CfgDescr
 
 // ===================================================================================
 // HID Report Descriptors
 // ===================================================================================
 extern __code uint8_t ReportDescr[];
-extern __code uint8_t ReportDescrLen;
+extern __code uint16_t ReportDescrLen;
 
 #define USB_REPORT_DESCR      ReportDescr
 #define USB_REPORT_DESCR_LEN  ReportDescrLen
@@ -83,4 +98,9 @@ extern __code uint16_t InterfDescr[];
 #define USB_STR_DESCR_ix    (uint8_t*)SerDescr
 
 #define USB_SEND_REPORT_KEYBOARD_PAGE_ID 0x01
-#define USB_SEND_REPORT_CONSUMER_PAGE_ID 0x02
\ No newline at end of file
+#define USB_SEND_REPORT_CONSUMER_PAGE_ID 0x02
+#define USB_SEND_REPORT_NKRO_PAGE_ID     0x03
+#define USB_SEND_REPORT_MOUSE_PAGE_ID    0x04
+
+// Keyboard usages 0..USB_NKRO_KEYS-1 in the NKRO bitmap report (id, mod, bitmap)
+#define USB_NKRO_KEYS   ((EP1_SIZE - 2) * 8)
\ No newline at end of file
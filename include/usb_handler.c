@@ -41,6 +41,7 @@ void USB_EP0_copyDescr(uint8_t len) {
 
 void USB_EP0_SETUP(void) {
   uint8_t len = USB_RX_LEN;
+  uint16_t descrLen;                              // descriptors may exceed 255 bytes
   if(len == (sizeof(USB_SETUP_REQ))) {
     SetupLen = ((uint16_t)USB_setupBuf->wLengthH<<8) | (USB_setupBuf->wLengthL);
     len = 0;                                      // default is success and upload 0 length
@@ -61,12 +62,12 @@ void USB_EP0_SETUP(void) {
 
             case USB_DESCR_TYP_DEVICE:            // Device Descriptor
               pDescr = (uint8_t*)&DevDescr;       // put descriptor into out buffer
-              len = sizeof(DevDescr);             // descriptor length
+              descrLen = sizeof(DevDescr);        // descriptor length
               break;
 
             case USB_DESCR_TYP_CONFIG:            // Configuration Descriptor
-              pDescr = (uint8_t*)&CfgDescr;       // put descriptor into out buffer
-              len = sizeof(CfgDescr);             // descriptor length
+              pDescr = (uint8_t*)USB_cfgDescr;    // put descriptor into out buffer
+              descrLen = sizeof(USB_CFG_DESCR_HID); // descriptor length
               break;
 
             case USB_DESCR_TYP_STRING:
@@ -95,29 +96,30 @@ void USB_EP0_SETUP(void) {
                 #endif
                 default:  pDescr = USB_STR_DESCR_ix; break;
               }
-              len = pDescr[0];                    // descriptor length
+              descrLen = pDescr[0];               // descriptor length
               break;
 
             #ifdef USB_REPORT_DESCR
             case USB_DESCR_TYP_REPORT:
               if(USB_setupBuf->wValueL == 0) {
                 pDescr = USB_REPORT_DESCR;
-                len = CfgDescr.hid0.wDescriptorLength;
+                descrLen = USB_cfgDescr->hid0.wDescriptorLength;
               } else if(USB_setupBuf->wValueL == 1) {
                 pDescr = USB_RAW_HID_REPORT_DESCR;
-                len = CfgDescr.RawHid1.wDescriptorLength;
+                descrLen = USB_cfgDescr->RawHid1.wDescriptorLength;
               } 
-              else len = 0xff;
+              else descrLen = 0xffff;
               break;
             #endif
 
             default:
-              len = 0xff;                         // unsupported descriptors or error
+              descrLen = 0xffff;                  // unsupported descriptors or error
               break;
           }
 
-          if(len != 0xff) {
-            if(SetupLen > len) SetupLen = len;    // limit length
+          if(descrLen == 0xffff) len = 0xff;
+          else {
+            if(SetupLen > descrLen) SetupLen = descrLen; // limit length
             len = SetupLen >= EP0_SIZE ? EP0_SIZE : SetupLen;
             USB_EP0_copyDescr(len);               // copy descriptor to Ep0
             SetupLen -= len;
@@ -147,7 +149,7 @@ void USB_EP0_SETUP(void) {
         case USB_CLEAR_FEATURE:
           if( (USB_setupBuf->bRequestType & 0x1F) == USB_REQ_RECIP_DEVICE ) {
             if( ( ( (uint16_t)USB_setupBuf->wValueH << 8 ) | USB_setupBuf->wValueL ) == 0x01 ) {
-              if( ((uint8_t*)&CfgDescr)[7] & 0x20) {
+              if( ((uint8_t*)USB_cfgDescr)[7] & 0x20) {
                 // wake up
               }
               else len = 0xFF;               // failed
@@ -207,7 +209,7 @@ void USB_EP0_SETUP(void) {
         case USB_SET_FEATURE:
           if( (USB_setupBuf->bRequestType & 0x1F) == USB_REQ_RECIP_DEVICE ) {
             if( ( ( (uint16_t)USB_setupBuf->wValueH << 8 ) | USB_setupBuf->wValueL ) == 0x01 ) {
-              if( !(((uint8_t*)&CfgDescr)[7] & 0x20) ) len = 0xFF;  // failed
+              if( !(((uint8_t*)USB_cfgDescr)[7] & 0x20) ) len = 0xFF;  // failed
             }
             else len = 0xFF;                                        // failed
           }
@@ -319,6 +321,13 @@ void USB_EP0_IN(void) {
 }
 
 void USB_EP0_OUT(void) {
+  #ifdef USB_CTRL_OUT_handler
+  if(USB_CTRL_OUT_handler()) {                    // data stage of a control write
+    UEP0_T_LEN = 0;
+    UEP0_CTRL |= UEP_R_RES_ACK | UEP_T_RES_ACK;   // status stage: 0-length packet
+    return;
+  }
+  #endif
   UEP0_T_LEN = 0;
   UEP0_CTRL |= UEP_R_RES_ACK | UEP_T_RES_NAK;     // respond Nak
 }
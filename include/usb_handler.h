@@ -25,6 +25,8 @@ __xdata __at(EP1_ADDR + 64)
 uint8_t EP1_SEND_buffer[EP1_BUF_SIZE];
 __xdata __at(EP2_ADDR)
 uint8_t EP2_buffer[EP2_BUF_SIZE];
+__xdata __at(EP2_ADDR + 64)
+uint8_t EP2_SEND_buffer[EP2_BUF_SIZE];
 
 #define USB_setupBuf ((PUSB_SETUP_REQ)EP0_buffer)
 extern uint8_t SetupReq;
@@ -36,7 +38,10 @@ void HID_setup(void);
 void HID_reset(void);
 void HID_EP1_IN(void);
 void HID_EP1_OUT(void);
+void HID_EP2_IN(void);
 void HID_EP2_OUT(void);
+uint8_t HID_control(void);
+uint8_t HID_controlOut(void);
 
 // ===================================================================================
 // USB Handler Defines
@@ -44,6 +49,8 @@ void HID_EP2_OUT(void);
 // Custom USB handler functions
 #define USB_INIT_handler HID_setup  // init custom endpoints
 #define USB_RESET_handler HID_reset // custom USB reset handler
+#define USB_CTRL_NS_handler HID_control // HID class requests
+#define USB_CTRL_OUT_handler HID_controlOut // data stage of HID class requests
 
 // Endpoint callback functions
 #define EP0_SETUP_callback USB_EP0_SETUP
@@ -51,6 +58,7 @@ void HID_EP2_OUT(void);
 #define EP0_OUT_callback USB_EP0_OUT
 #define EP1_IN_callback HID_EP1_IN
 #define EP1_OUT_callback HID_EP1_OUT
+#define EP2_IN_callback HID_EP2_IN
 #define EP2_OUT_callback HID_EP2_OUT
 
 // ===================================================================================
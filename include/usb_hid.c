@@ -7,15 +7,63 @@
 #include "usb.h"
 #include "usb_descr.h"
 #include "usb_handler.h"
+#include "latency.h"
 
 // ===================================================================================
 // Variables and Defines
 // ===================================================================================
 
 volatile __bit HID_EP1_writeBusyFlag = 0; // upload pointer busy flag
+volatile __bit HID_EP2_writeBusyFlag = 0; // raw HID reply pending flag
+__bit HID_sendTracked;                    // armed report is timed by LAT
+uint16_t HID_sendMark;                    // edge time of armed report
+uint16_t HID_sendMarkMs;                  // edge time of armed report in ms
+
+// Report queue: filled by the main loop, drained by the EP1 IN interrupt.
+// While the endpoint is idle the queue is always empty.
+__xdata uint8_t HID_queue[HID_QUEUE_SIZE][EP1_SIZE]; // queued reports
+__xdata uint8_t HID_queueLen[HID_QUEUE_SIZE];        // length of queued reports
+__xdata uint8_t HID_queueTracked[HID_QUEUE_SIZE];    // queued report is timed
+__xdata uint16_t HID_queueMark[HID_QUEUE_SIZE];      // edge time of queued report
+__xdata uint16_t HID_queueMarkMs[HID_QUEUE_SIZE];    // edge time in ms
+volatile uint8_t HID_queueHead = 0;                  // written by main loop only
+volatile uint8_t HID_queueTail = 0;                  // written by interrupt only
+
+volatile uint8_t HID_protocol = HID_PROTOCOL_REPORT; // keyboard protocol
+volatile uint8_t HID_feature = 0;                    // mouse resolution multiplier
+__bit HID_featureOut;                                // SET_REPORT data stage pending
 
 // uint8_t   SetupReq,SetupLen,Ready,Count,FLAG,UsbConfig;
 uint8_t len, i;
+
+// ===================================================================================
+// Fast Copy Function
+// ===================================================================================
+// Copy HID_copyLen (1..255) bytes from xdata *src to xdata *HID_copyDst using
+// both data pointers, about 5 clock cycles per byte. DPTR1 is also used by
+// USB_EP0_copyDescr, so outside of the USB interrupt the USB interrupt must be
+// disabled while copying.
+__xdata uint8_t *HID_copyDst; // copy destination
+uint8_t HID_copyLen;          // number of bytes to copy
+
+#pragma callee_saves HID_copy
+void HID_copy(__xdata uint8_t *src) {
+  src;                          // stop unreferenced argument warning
+  __asm
+    push ar7                    ; r7 -> stack
+    mov  r7, _HID_copyLen       ; r7 <- len
+    inc  _XBUS_AUX              ; select dptr1
+    mov  dpl, _HID_copyDst      ; dptr1 <- HID_copyDst
+    mov  dph, (_HID_copyDst + 1)
+    dec  _XBUS_AUX              ; select dptr0 (src)
+    01$:
+    movx a, @dptr               ; acc <- src[dptr0]
+    inc  dptr                   ; inc dptr0
+    .DB  0xA5                   ; acc -> HID_copyDst[dptr1] & inc dptr1
+    djnz r7, 01$                ; repeat len times
+    pop  ar7                    ; r7 <- stack
+  __endasm;
+}
 // ===================================================================================
 // Front End Functions
 // ===================================================================================
@@ -26,17 +74,61 @@ void HID_init(void) {
   UEP1_T_LEN = 0;
 }
 
-// Send HID report
+// Number of reports that can be queued without waiting
+uint8_t HID_queueFree(void) {
+  return HID_QUEUE_SIZE - (uint8_t)(HID_queueHead - HID_queueTail);
+}
+
+// Send HID report: arm the endpoint if it is idle, otherwise queue the report
+// and return at once. Only waits if the queue is full, callers that must not
+// block check HID_queueFree() first.
 void HID_sendReport(__xdata uint8_t *buf, uint8_t len) {
-  uint8_t i;
-  while (HID_EP1_writeBusyFlag)
-    ; // wait for ready to write
-  for (i = 0; i < len; i++)
-    EP1_SEND_buffer[i] = buf[i];  // copy report to EP1 buffer
-  UEP1_T_LEN = len;          // set length to upload
-  HID_EP1_writeBusyFlag = 1; // set busy flag
-  UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_T_RES |
-              UEP_T_RES_ACK; // upload data and respond ACK
+  if (!len)
+    return; // nothing to send
+  while (!HID_queueFree())
+    ; // wait for a free slot
+  IE_USB = 0; // keep EP1 IN handler and its DPTR1 use out
+  if (LAT_pending) // first report of an input event?
+    LAT_record(LAT_STAGE_QUEUE, LAT_ticks(LAT_mark, LAT_markMs));
+  HID_copyLen = len;
+  if (!HID_EP1_writeBusyFlag) {
+    HID_copyDst = EP1_SEND_buffer; // copy report to EP1 buffer
+    HID_copy(buf);
+    HID_sendTracked = LAT_pending;
+    HID_sendMark = LAT_mark;
+    HID_sendMarkMs = LAT_markMs;
+    UEP1_T_LEN = len;              // set length to upload
+    HID_EP1_writeBusyFlag = 1;     // set busy flag
+    UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_T_RES |
+                UEP_T_RES_ACK; // upload data and respond ACK
+  } else {
+    HID_copyDst = HID_queue[HID_queueHead & (HID_QUEUE_SIZE - 1)];
+    HID_copy(buf); // copy report to queue slot
+    HID_queueLen[HID_queueHead & (HID_QUEUE_SIZE - 1)] = len;
+    HID_queueTracked[HID_queueHead & (HID_QUEUE_SIZE - 1)] = LAT_pending;
+    HID_queueMark[HID_queueHead & (HID_QUEUE_SIZE - 1)] = LAT_mark;
+    HID_queueMarkMs[HID_queueHead & (HID_QUEUE_SIZE - 1)] = LAT_markMs;
+    HID_queueHead++;
+  }
+  LAT_pending = 0; // time only the first report of an event
+  IE_USB = 1;
+}
+
+// Send raw HID reply (padded to a full report). The reply is dropped if the
+// host has not yet fetched the previous one.
+void HID_reply(__xdata uint8_t *buf, uint8_t len) {
+  if (!len || HID_EP2_writeBusyFlag)
+    return;
+  IE_USB = 0; // HID_copy uses DPTR1
+  HID_copyDst = EP2_SEND_buffer;
+  HID_copyLen = len;
+  HID_copy(buf);
+  while (len < EP2_SIZE)
+    EP2_SEND_buffer[len++] = 0;
+  UEP2_T_LEN = EP2_SIZE;
+  HID_EP2_writeBusyFlag = 1;
+  UEP2_CTRL = UEP2_CTRL & ~MASK_UEP_T_RES | UEP_T_RES_ACK;
+  IE_USB = 1;
 }
 
 // ===================================================================================
@@ -51,10 +143,11 @@ void HID_setup(void) {
               | UEP_T_RES_NAK // EP1 IN transaction returns NAK
               | UEP_R_RES_ACK; // EP1 OUT transaction returns ACK
   UEP2_CTRL = bUEP_AUTO_TOG    // EP2 Auto flip sync flag
+              | UEP_T_RES_NAK // EP2 IN transaction returns NAK
               | UEP_R_RES_ACK; // EP2 OUT transaction returns ACK
   UEP4_1_MOD = bUEP1_TX_EN | bUEP1_RX_EN ;    // EP1 RX / TX enable // EP1 buffer for send is at EP1_ADDR + 64
   // UINT8X 		Ep2Buffer[DUAL_BUFFER_SIZE]	_at_ 0x0050;  								// Endpoint 2, buffer OUT[64]+IN[64]��the address must be even.
-  UEP2_3_MOD = bUEP2_RX_EN;    // EP2 RX enable
+  UEP2_3_MOD = bUEP2_RX_EN | bUEP2_TX_EN; // EP2 RX / TX enable // EP2 buffer for send is at EP2_ADDR + 64
 }
 
 volatile __xdata uint8_t USBByteCountEP2 =
@@ -89,26 +182,113 @@ char HID_read() {
 // Reset HID parameters
 void HID_reset(void) {
   UEP1_CTRL = bUEP_AUTO_TOG | UEP_T_RES_NAK | UEP_R_RES_ACK;
-  UEP2_CTRL = bUEP_AUTO_TOG | UEP_R_RES_ACK;
+  UEP2_CTRL = bUEP_AUTO_TOG | UEP_T_RES_NAK | UEP_R_RES_ACK;
   HID_EP1_writeBusyFlag = 0;
+  HID_EP2_writeBusyFlag = 0;
+  HID_sendTracked = 0;
+  HID_queueTail = HID_queueHead; // drop queued reports
+  HID_protocol = HID_PROTOCOL_REPORT;
+  HID_feature = 0;
+  HID_featureOut = 0;
 }
 
+// HID class requests: protocol switch for boot hosts, idle rate (reports are
+// only sent on changes, so the idle rate is always 0) and the mouse feature
+// report
+#pragma save
+#pragma nooverlay
+uint8_t HID_control(void) {
+  if ((USB_setupBuf->bRequestType & USB_REQ_TYP_MASK) != USB_REQ_TYP_CLASS)
+    return 0xFF; // not supported
+  switch (SetupReq) {
+  case HID_GET_PROTOCOL:
+    EP0_buffer[0] = USB_setupBuf->wIndexL ? HID_PROTOCOL_REPORT : HID_protocol;
+    return 1;
+  case HID_SET_PROTOCOL:
+    if (!USB_setupBuf->wIndexL) // keyboard interface
+      HID_protocol = USB_setupBuf->wValueL;
+    return 0;
+  case HID_GET_IDLE:
+    EP0_buffer[0] = 0;
+    return 1;
+  case HID_SET_IDLE:
+    return 0;
+#ifdef MOUSE_WHEEL
+  case HID_GET_REPORT:
+  case HID_SET_REPORT:
+    if (USB_setupBuf->wValueH != 3 || // feature report
+        USB_setupBuf->wValueL != USB_SEND_REPORT_MOUSE_PAGE_ID)
+      return 0xFF;
+    if (SetupReq == HID_SET_REPORT) {
+      HID_featureOut = 1; // data follows in the OUT stage
+      return 0;
+    }
+    EP0_buffer[0] = USB_SEND_REPORT_MOUSE_PAGE_ID;
+    EP0_buffer[1] = HID_feature;
+    return 2;
+#endif
+  default:
+    return 0xFF;
+  }
+}
+
+// Data stage of SET_REPORT: take over the resolution multiplier
+uint8_t HID_controlOut(void) {
+  if (!HID_featureOut)
+    return 0; // status stage of another request
+  HID_featureOut = 0;
+  if (U_TOG_OK && USB_RX_LEN >= 2 &&
+      EP0_buffer[0] == USB_SEND_REPORT_MOUSE_PAGE_ID)
+    HID_feature = EP0_buffer[1];
+  return 1;
+}
+#pragma restore
+
 // Endpoint 1 IN handler (HID report transfer to host)
+#pragma save
+#pragma nooverlay
 void HID_EP1_IN(void) {
-  UEP1_T_LEN = 0; // no data to send anymore
-  UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_T_RES | UEP_T_RES_NAK; // default NAK
-  HID_EP1_writeBusyFlag = 0;                               // clear busy flag
+  if (HID_sendTracked) // report of an input event reached the host
+    LAT_record(LAT_STAGE_USB, LAT_ticks(HID_sendMark, HID_sendMarkMs));
+  if (HID_queueHead != HID_queueTail) { // arm next queued report
+    HID_copyDst = EP1_SEND_buffer;
+    HID_copyLen = HID_queueLen[HID_queueTail & (HID_QUEUE_SIZE - 1)];
+    HID_copy(HID_queue[HID_queueTail & (HID_QUEUE_SIZE - 1)]);
+    HID_sendTracked = HID_queueTracked[HID_queueTail & (HID_QUEUE_SIZE - 1)];
+    HID_sendMark = HID_queueMark[HID_queueTail & (HID_QUEUE_SIZE - 1)];
+    HID_sendMarkMs = HID_queueMarkMs[HID_queueTail & (HID_QUEUE_SIZE - 1)];
+    UEP1_T_LEN = HID_copyLen;
+    UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_T_RES | UEP_T_RES_ACK;
+    HID_queueTail++;
+  } else {
+    UEP1_T_LEN = 0; // no data to send anymore
+    UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_T_RES | UEP_T_RES_NAK; // default NAK
+    HID_EP1_writeBusyFlag = 0;                               // clear busy flag
+    HID_sendTracked = 0;
+  }
+}
+
+// Endpoint 2 IN handler (raw HID reply fetched by host)
+void HID_EP2_IN(void) {
+  UEP2_T_LEN = 0;
+  UEP2_CTRL = UEP2_CTRL & ~MASK_UEP_T_RES | UEP_T_RES_NAK; // default NAK
+  HID_EP2_writeBusyFlag = 0;
 }
+#pragma restore
 
 void HID_EP1_OUT() {
   if (U_TOG_OK) // Discard unsynchronized packets
   {
-    switch (EP1_buffer[0]) {
-    case 1:
-      statusLed = EP1_buffer[1];
-      break;
-    default:
-      break;
+    if (HID_protocol == HID_PROTOCOL_BOOT) // boot report: no report ID
+      statusLed = EP1_buffer[0];
+    else {
+      switch (EP1_buffer[0]) {
+      case 1:
+        statusLed = EP1_buffer[1];
+        break;
+      default:
+        break;
+      }
     }
   }
 }
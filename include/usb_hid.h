@@ -5,8 +5,24 @@
 #pragma once
 #include <stdint.h>
 
+#define HID_QUEUE_SIZE 8 // queued EP1 IN reports (power of two)
+
+// Keyboard protocol selected by the host (SET_PROTOCOL), boot protocol reports
+// carry no report ID and only the keyboard report is understood
+#define HID_PROTOCOL_BOOT   0
+#define HID_PROTOCOL_REPORT 1
+extern volatile uint8_t HID_protocol;
+
+// Resolution Multiplier feature report of the mouse (SET_REPORT by the host),
+// a set bit selects ENC_STEPS_PER_DETENT units per detent for that axis
+#define HID_FEATURE_WHEEL   0x01
+#define HID_FEATURE_PAN     0x04
+extern volatile uint8_t HID_feature;
+
 void HID_init(void);                                    // setup USB-HID
-void HID_sendReport(__xdata uint8_t *buf, uint8_t len); // send HID report
+void HID_sendReport(__xdata uint8_t *buf, uint8_t len); // queue HID report
+uint8_t HID_queueFree(void);                            // free report slots
+void HID_reply(__xdata uint8_t *buf, uint8_t len);      // send raw HID reply
 uint8_t HID_statusLed();
 uint8_t HID_available();
 void HID_ack();
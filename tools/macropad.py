@@ -0,0 +1,174 @@
+import argparse
+import colorsys
+import struct
+import time
+
+import hid
+
+VENDOR_ID = 0x4249
+PRODUCT_ID = 0x4287
+
+SET_POLLING = 0x04
+GET_LATENCY = 0x05
+SET_EFFECT = 0x06
+STREAM_FRAME = 0x07
+GET_STREAM = 0x08
+SET_BRIGHTNESS = 0x0A
+READ_CONFIG = 0x0B
+WRITE_CONFIG = 0x0C
+COMMIT_CONFIG = 0x0D
+CONFIG_CHUNK = 29
+
+STAGES = ["event", "queue", "usb", "irqoff", "combo", "gap"]
+EFFECTS = ["static", "breathe", "rainbow", "reactive", "fadeout"]
+BUCKETS = ["<250us", "<500us", "<1ms", "<2ms", "<4ms", "<8ms", "<16ms", ">=16ms"]
+
+
+def open_device():
+    h = hid.device()
+    for device_dict in hid.enumerate(vendor_id=VENDOR_ID, product_id=PRODUCT_ID):
+        if device_dict['interface_number'] == 1:
+            h.open_path(device_dict['path'])
+            return h
+    raise SystemExit("MacroPad not found")
+
+
+def polling(h, args):
+    h.write([SET_POLLING, 1 if args.profile == "fast" else 0])
+    reply = bytes(h.read(32, 1000))
+    if len(reply) < 2 or reply[0] != SET_POLLING:
+        raise SystemExit("No reply from device")
+    if not reply[1]:
+        raise SystemExit("Storing the polling profile failed")
+    print("Polling profile set to " + args.profile + ", replug the device")
+
+
+def crc8(data):
+    crc = 0xFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x31) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def read_config(h):
+    data = b""
+    while True:
+        h.write([READ_CONFIG, len(data)])
+        reply = bytes(h.read(32, 1000))
+        if len(reply) < 3 or reply[0] != READ_CONFIG or reply[1] != len(data):
+            raise SystemExit("No reply from device")
+        data += reply[3:3 + min(CONFIG_CHUNK, reply[2] - len(data))]
+        if len(data) >= reply[2]:
+            return data
+
+
+def config_dump(h, args):
+    data = read_config(h)
+    with open(args.file, "wb") as f:
+        f.write(data)
+    print("%d bytes (version %d) saved, checksum %02x" % (len(data), data[0], crc8(data)))
+
+
+def config_load(h, args):
+    with open(args.file, "rb") as f:
+        data = f.read()
+    if len(data) != len(read_config(h)):
+        raise SystemExit("Config size does not match the firmware")
+    for offset in range(0, len(data), CONFIG_CHUNK):
+        chunk = data[offset:offset + CONFIG_CHUNK]
+        h.write([WRITE_CONFIG, offset, len(chunk)] + list(chunk))
+    h.write([COMMIT_CONFIG, crc8(data)])
+    reply = bytes(h.read(32, 1000))
+    if len(reply) < 3 or reply[0] != COMMIT_CONFIG:
+        raise SystemExit("No reply from device")
+    if not reply[1]:
+        raise SystemExit("Config rejected (device checksum %02x, ours %02x)" % (reply[2], crc8(data)))
+    print("Config stored, checksum %02x" % reply[2])
+
+
+def brightness(h, args):
+    h.write([SET_BRIGHTNESS, args.brightness])
+
+
+def effect(h, args):
+    led = 0xFF if args.led is None else args.led
+    h.write([SET_EFFECT, led, EFFECTS.index(args.effect), args.speed, args.level])
+
+
+def stream(h, args):
+    h.write([GET_STREAM])  # clear the statistics of earlier streams
+    h.read(32, 1000)
+    period = 1.0 / args.fps
+    start = time.monotonic()
+    for n in range(int(args.seconds * args.fps)):
+        pixels = []
+        for led in range(args.pixels):
+            r, g, b = colorsys.hsv_to_rgb((n / args.fps / 4 + led / args.pixels) % 1, 1, 1)
+            pixels += [int(r * 255), int(g * 255), int(b * 255)]
+        h.write([STREAM_FRAME, n & 0xFF] + pixels)
+        time.sleep(max(0, start + (n + 1) * period - time.monotonic()))
+    h.write([GET_STREAM])
+    reply = bytes(h.read(32, 1000))
+    if len(reply) < 9 or reply[0] != GET_STREAM:
+        raise SystemExit("No reply from device")
+    received, shown, late, dropped = struct.unpack_from("<4H", reply, 1)
+    print("received=%d shown=%d late=%d dropped=%d" % (received, shown, late, dropped))
+
+
+def latency(h, args):
+    for stage in args.stage or STAGES:
+        h.write([GET_LATENCY, STAGES.index(stage), int(args.clear)])
+        reply = bytes(h.read(32, 1000))
+        if len(reply) < 32 or reply[0] != GET_LATENCY:
+            raise SystemExit("No reply from device")
+        ticks_per_ms, lo, hi, total, count = struct.unpack_from("<HHHIH", reply, 2)
+        hist = struct.unpack_from("<8H", reply, 14)
+        us = lambda t: t * 1000.0 / ticks_per_ms
+        print("%-6s n=%-5d" % (stage, count), end="")
+        if count:
+            print(" min=%.0fus avg=%.0fus max=%.0fus" % (us(lo), us(total / count), us(hi)))
+            print("       " + "  ".join("%s:%d" % b for b in zip(BUCKETS, hist)))
+        else:
+            print()
+        if stage == "event":
+            print("       event ring high-water mark: %d" % reply[30])
+            print("       macro starts dropped (queue full): %d" % reply[31])
+
+
+parser = argparse.ArgumentParser(description="MacroPad raw HID tool")
+sub = parser.add_subparsers(dest="command", required=True)
+p = sub.add_parser("polling", help="select USB polling profile (after replug)")
+p.add_argument("profile", choices=["standard", "fast"])
+p.set_defaults(func=polling)
+p = sub.add_parser("config-dump", help="save the device configuration to a file")
+p.add_argument("file")
+p.set_defaults(func=config_dump)
+p = sub.add_parser("config-load", help="write a configuration file to the device")
+p.add_argument("file")
+p.set_defaults(func=config_load)
+p = sub.add_parser("brightness", help="set global LED brightness")
+p.add_argument("brightness", type=int, help="0..255")
+p.set_defaults(func=brightness)
+p = sub.add_parser("effect", help="set LED effect")
+p.add_argument("effect", choices=EFFECTS)
+p.add_argument("--led", type=int, help="LED index (default: all)")
+p.add_argument("--speed", type=int, default=3, help="step per 5 ms tick")
+p.add_argument("--level", type=int, default=102, help="brightness (0..255)")
+p.set_defaults(func=effect)
+p = sub.add_parser("stream", help="stream a rainbow and show frame statistics")
+p.add_argument("--fps", type=float, default=100, help="frames per second")
+p.add_argument("--seconds", type=float, default=10, help="duration")
+p.add_argument("--pixels", type=int, default=3, choices=range(1, 11), metavar="1..10",
+               help="pixels in the chain (NEO_COUNT)")
+p.set_defaults(func=stream)
+p = sub.add_parser("latency", help="show input latency counters")
+p.add_argument("stage", nargs="*", choices=STAGES)
+p.add_argument("--clear", action="store_true", help="clear counters after reading")
+p.set_defaults(func=latency)
+
+args = parser.parse_args()
+h = open_device()
+args.func(h, args)
+h.close()